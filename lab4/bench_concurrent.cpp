@@ -0,0 +1,111 @@
+#include "concurrent.h"
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/** units in each chain of rules */
+static const size_t CHAIN = 1000;
+/** separate chains, so some pairs are unreachable */
+static const size_t CHAINS = 8;
+/** conversions each reader thread performs */
+static const size_t LOOKUPS = 2000000;
+
+/** a (from, to) pair of units to convert between */
+using UnitPair = pair<unit_id, unit_id>;
+
+/** random (from, to) pairs, each thread walks its own slice */
+static vector<UnitPair> make_pairs(size_t count) {
+    mt19937 rng(11);
+    uniform_int_distribution<size_t> pick(0, CHAIN * CHAINS - 1);
+    vector<UnitPair> pairs(count);
+    for (auto &p : pairs) {
+        p.first  = UnitSymbols::intern("u" + to_string(pick(rng)));
+        p.second = UnitSymbols::intern("u" + to_string(pick(rng)));
+    }
+    return pairs;
+}
+
+/** runs 'threads' copies of 'lookup' and reports millions of lookups/s */
+template <typename Lookup>
+static double run(size_t threads, const vector<UnitPair> &pairs,
+                  Lookup lookup) {
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            size_t offset = t * 7919;
+            for (size_t i = 0; i < LOOKUPS; i++) {
+                lookup(pairs[(offset + i) % pairs.size()]);
+            }
+        });
+    }
+    for (thread &w : workers) {
+        w.join();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return threads * LOOKUPS / elapsed.count() / 1e6;
+}
+
+/** compares lock-free readers against one converter behind a mutex, with
+ *  and without a writer publishing new rules the whole time */
+int main() {
+    UnitConverter rules;
+    for (size_t c = 0; c < CHAINS; c++) {
+        for (size_t i = 1; i < CHAIN; i++) {
+            size_t u = c * CHAIN + i;
+            rules.add_conversion("u" + to_string(u - 1), 1.0 + i % 7 * 0.125,
+                                 "u" + to_string(u));
+        }
+    }
+    ConcurrentConverter shared(rules);
+    mutex rules_lock;
+    vector<UnitPair> pairs = make_pairs(1 << 16);
+
+    size_t max_threads = max<size_t>(thread::hardware_concurrency(), 1);
+    vector<size_t> counts;
+    for (size_t t = 1; t < max_threads; t *= 2) {
+        counts.push_back(t);
+    }
+    counts.push_back(max_threads);
+
+    printf("%8s %14s %14s %14s\n", "threads", "mutex Mops/s",
+           "lock-free", "with writer");
+    for (size_t threads : counts) {
+        double locked = run(threads, pairs, [&](UnitPair p) {
+            Affine conversion;
+            lock_guard<mutex> lock(rules_lock);
+            rules.find_conversion(p.first, p.second, conversion);
+        });
+        double lockfree = run(threads, pairs, [&](UnitPair p) {
+            Affine conversion;
+            shared.find_conversion(p.first, p.second, conversion);
+        });
+
+        // a writer keeps adding rules while the readers run
+        atomic<bool> done{false};
+        size_t published = 0;
+        thread writer([&]() {
+            while (!done) {
+                string name = "w" + to_string(published++);
+                shared.add_conversion(name, 2, "u0");
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        });
+        double contended = run(threads, pairs, [&](UnitPair p) {
+            Affine conversion;
+            shared.find_conversion(p.first, p.second, conversion);
+        });
+        done = true;
+        writer.join();
+
+        printf("%8zu %14.1f %14.1f %14.1f  (%zu versions published)\n",
+               threads, locked, lockfree, contended, published);
+    }
+    return 0;
+}
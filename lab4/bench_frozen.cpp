@@ -0,0 +1,154 @@
+#include "frozen.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/** packaging levels of every SKU, each converting to the one before */
+static const char *const LEVELS[] = { "each", "inner", "case", "pallet" };
+/** how many of the level before make one of each level */
+static const double PER_LEVEL[] = { 1, 6, 4, 40 };
+/** lookups and path searches timed on each representation */
+static const size_t LOOKUPS = 2000000;
+static const size_t SEARCHES = 20;
+
+/** bytes currently allocated, counting blocks malloc mapped on its own */
+static size_t heap_in_use() {
+    struct mallinfo2 m = mallinfo2();
+    return m.uordblks + m.hblkhd;
+}
+
+/** seconds since 'start' */
+static double since(chrono::steady_clock::time_point start) {
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/** a synthetic SKU catalogue: every SKU has an each, inner, case and
+ *  pallet unit, and every SKU's each is one 'ea', which joins the whole
+ *  catalogue into one component with a very busy hub
+ *
+ * usage: bench_frozen [SKUS]   (default 250000, so a million units)
+ */
+int main(int argc, char **argv) {
+    size_t skus = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 250000;
+    if (skus == 0) {
+        fprintf(stderr, "usage: %s [SKUS]\n", argv[0]);
+        return 1;
+    }
+
+    // intern every name first, so the symbol table isn't counted below
+    vector<string> names;
+    names.reserve(skus * 4);
+    for (size_t s = 0; s < skus; s++) {
+        for (const char *level : LEVELS) {
+            names.push_back("sku" + to_string(s) + "/" + level);
+        }
+    }
+    UnitSymbols::intern("ea");
+    for (const string &name : names) {
+        UnitSymbols::intern(name);
+    }
+
+    size_t before = heap_in_use();
+    auto start = chrono::steady_clock::now();
+    UnitConverter rules;
+    for (size_t s = 0; s < skus; s++) {
+        rules.add_conversion(names[s * 4], 1, "ea");
+        for (size_t level = 1; level < 4; level++) {
+            rules.add_conversion(names[s * 4 + level], PER_LEVEL[level],
+                                 names[s * 4 + level - 1]);
+        }
+    }
+    double load_seconds = since(start);
+    size_t converter_heap = heap_in_use() - before;
+
+    before = heap_in_use();
+    start = chrono::steady_clock::now();
+    FrozenGraph frozen = rules.freeze();
+    double freeze_seconds = since(start);
+    size_t frozen_heap = heap_in_use() - before;
+
+    size_t count = rules.rule_count();
+    GraphMemory a = rules.memory_usage(), b = frozen.memory_usage();
+    printf("%zu units, %zu rules (loaded in %.2fs, frozen in %.2fs)\n\n",
+           frozen.unit_count(), count, load_seconds, freeze_seconds);
+    printf("%-12s %12s %12s %12s %12s %10s\n", "", "edges", "per unit",
+           "other", "total", "per rule");
+    printf("%-12s %12zu %12zu %12zu %12zu %10.1f\n", "converter",
+           a.edge_bytes, a.unit_bytes, a.other_bytes, a.total(),
+           (double) a.total() / count);
+    printf("%-12s %12zu %12zu %12zu %12zu %10.1f\n", "frozen",
+           b.edge_bytes, b.unit_bytes, b.other_bytes, b.total(),
+           (double) b.total() / count);
+    printf("measured heap growth: converter %zu bytes, frozen %zu bytes\n\n",
+           converter_heap, frozen_heap);
+
+    // random pairs of units, all in the one component
+    mt19937 rng(23);
+    uniform_int_distribution<size_t> pick(0, names.size() - 1);
+    vector<pair<unit_id, unit_id>> pairs(1 << 16);
+    for (auto &p : pairs) {
+        p.first  = UnitSymbols::intern(names[pick(rng)]);
+        p.second = UnitSymbols::intern(names[pick(rng)]);
+    }
+
+    // summing the factors keeps the lookups from being optimized away
+    double sum = 0;
+    Affine conversion;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        const auto &p = pairs[i % pairs.size()];
+        rules.find_conversion(p.first, p.second, conversion);
+        sum += conversion.scale;
+    }
+    double converter_lookups = LOOKUPS / since(start) / 1e6;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        const auto &p = pairs[i % pairs.size()];
+        frozen.find_conversion(p.first, p.second, conversion);
+        sum += conversion.scale;
+    }
+    double frozen_lookups = LOOKUPS / since(start) / 1e6;
+
+    // a search between two pallets passes the hub, so it scans every edge
+    size_t steps = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < SEARCHES; i++) {
+        const auto &p = pairs[i];
+        steps += rules.conversion_path(UnitSymbols::name(p.first),
+                                       UnitSymbols::name(p.second)).size();
+    }
+    double converter_search = since(start) / SEARCHES * 1e3;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < SEARCHES; i++) {
+        const auto &p = pairs[i];
+        steps -= frozen.conversion_path(p.first, p.second).size();
+    }
+    double frozen_search = since(start) / SEARCHES * 1e3;
+
+    printf("%-12s %16s %16s\n", "", "lookups Mops/s", "path search ms");
+    printf("%-12s %16.1f %16.2f\n", "converter", converter_lookups,
+           converter_search);
+    printf("%-12s %16.1f %16.2f\n", "frozen", frozen_lookups, frozen_search);
+    printf("(checksum %g)\n", sum);
+
+    // both must give the same factors and path lengths
+    bool same = (steps == 0);
+    for (const auto &p : pairs) {
+        Affine x, y;
+        rules.find_conversion(p.first, p.second, x);
+        frozen.find_conversion(p.first, p.second, y);
+        same = same && (x.scale == y.scale) && (x.offset == y.offset);
+    }
+    if (!same) {
+        fprintf(stderr, "frozen graph disagrees with the converter\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,273 @@
+#include "concurrent.h"
+#include "scale.h"
+#include <string>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+/** hands each thread its own stripe, round robin */
+static size_t this_stripe(size_t stripes) {
+    static atomic<size_t> next_stripe{0};
+    thread_local size_t stripe = next_stripe.fetch_add(1) % stripes;
+    return stripe;
+}
+
+/** registers under the current epoch before loading the version, and
+ *  retries if a writer published in between, since the writer may then have
+ *  counted readers before this one showed up */
+class ConcurrentConverter::Reader {
+    /** the counter this reader registered in */
+    atomic<size_t> *count;
+
+public:
+    /** the pinned version */
+    const UnitConverter *converter;
+
+    Reader(const ConcurrentConverter &owner) {
+        Stripe &stripe = owner.stripes[this_stripe(STRIPES)];
+        while (true) {
+            uint64_t e = owner.epoch.load();
+            count = &stripe.readers[e & 1];
+            count->fetch_add(1);
+            if (owner.epoch.load() == e) {
+                break;
+            }
+            count->fetch_sub(1);
+        }
+        converter = owner.current.load();
+    }
+
+    ~Reader() {
+        count->fetch_sub(1, memory_order_release);
+    }
+
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+};
+
+/** publishes a private copy of the starting rules */
+ConcurrentConverter::ConcurrentConverter(const UnitConverter &initial)
+    : current(new UnitConverter(initial)), epoch(0) {
+    for (Stripe &stripe : stripes) {
+        stripe.readers[0] = 0;
+        stripe.readers[1] = 0;
+    }
+}
+
+ConcurrentConverter::~ConcurrentConverter() {
+    delete current.load();
+}
+
+/** swap, flip the epoch, then wait out the readers of the old parity.
+ *  anyone registering after the flip loads the new version. the flip and
+ *  the counter loads are sequentially consistent, like the reader's
+ *  register-then-check, so one side always sees the other */
+void ConcurrentConverter::publish(const UnitConverter *next) {
+    const UnitConverter *old = current.exchange(next);
+    uint64_t e = epoch.fetch_add(1);
+
+    for (Stripe &stripe : stripes) {
+        while (stripe.readers[e & 1].load() != 0) {
+            this_thread::yield();
+        }
+    }
+    delete old;
+}
+
+/** a resolved name without operators is a rule unit or a prefixed one, of
+ *  which there are only so many, so interning it can't grow without bound */
+bool ConcurrentConverter::find_resolved(const string &units, unit_id &id) {
+    if (UnitSymbols::find(units, id)) {
+        return true;
+    }
+    if (units.find_first_of("*/^") != string::npos) {
+        return false;
+    }
+    id = UnitSymbols::intern(units);
+    return true;
+}
+
+/** a name converts to itself exactly when it is known or a valid
+ *  expression, so that is checked before anything is interned */
+bool ConcurrentConverter::find_units(const string &units, unit_id &id) const
+{
+    if (UnitSymbols::find(units, id)) {
+        return true;
+    }
+    Affine conversion;
+    if (!find_conversion(units, units, conversion)) {
+        return false;
+    }
+    id = UnitSymbols::intern(units);
+    return true;
+}
+
+/** resolves against the pinned version, skipping its cache */
+bool ConcurrentConverter::find_conversion
+(   unit_id from_units, unit_id to_units, Affine &conversion   ) const
+{
+    Reader reader(*this);
+    return reader.converter->find_conversion(from_units, to_units, conversion);
+}
+
+/** names are resolved against the pinned version without interning */
+bool ConcurrentConverter::find_conversion
+(   const string &from_units, const string &to_units, Affine &conversion
+)   const
+{
+    Reader reader(*this);
+    return reader.converter->find_conversion(from_units, to_units, conversion);
+}
+
+/** convertible iff a conversion resolves */
+bool ConcurrentConverter::can_convert
+(   const string &from_units, const string &to_units   ) const
+{
+    Affine conversion;
+    return find_conversion(from_units, to_units, conversion);
+}
+
+/** the same as try_convert, but throws */
+UValue ConcurrentConverter::convert_to
+(   const UValue &input, const string &to_units   ) const
+{
+    optional<UValue> result = try_convert(input, to_units);
+    if (!result) {
+        string e_message = "Don't know how to convert from " \
+                           + input.get_units() + " to " + to_units;
+        throw invalid_argument(e_message);
+    }
+    return *result;
+}
+
+/** resolves once and applies the conversion */
+UValue ConcurrentConverter::convert_to
+(   const UValue &input, unit_id to_units   ) const
+{
+    optional<UValue> result = try_convert(input, to_units);
+    if (!result) {
+        string e_message = "Don't know how to convert from " \
+                           + input.get_units() + " to " \
+                           + UnitSymbols::name(to_units);
+        throw invalid_argument(e_message);
+    }
+    return *result;
+}
+
+/** the target is only interned once it has converted */
+optional<UValue> ConcurrentConverter::try_convert
+(   const UValue &input, const string &to_units   ) const
+{
+    Affine conversion;
+    unit_id to;
+    if (!find_conversion(input.get_units(), to_units, conversion) ||
+        !find_resolved(to_units, to)) {
+        return nullopt;
+    }
+    return UValue{conversion.apply(input.get_value()), to};
+}
+
+/** nothing for unconnected pairs */
+optional<UValue> ConcurrentConverter::try_convert
+(   const UValue &input, unit_id to_units   ) const
+{
+    Affine conversion;
+    if (!find_conversion(input.get_unit_id(), to_units, conversion)) {
+        return nullopt;
+    }
+    return UValue{conversion.apply(input.get_value()), to_units};
+}
+
+/** resolves once, then hands the array to the scale kernel */
+void ConcurrentConverter::convert_batch
+(   const double *in, double *out, size_t count, const string &from_units,
+    const string &to_units
+)   const
+{
+    Affine conversion;
+    if (!find_conversion(from_units, to_units, conversion)) {
+        string e_message = "Don't know how to convert from " + from_units \
+                           + " to " + to_units;
+        throw invalid_argument(e_message);
+    }
+    scale(in, out, count, conversion.scale, conversion.offset);
+}
+
+/** resolves the names first, and only interns them if they convert */
+ConversionPlan ConcurrentConverter::plan
+(   const string &from_units, const string &to_units   ) const
+{
+    Reader reader(*this);
+    Affine conversion;
+    unit_id from, to;
+    if (!reader.converter->find_conversion(from_units, to_units,
+                                           conversion) ||
+        !find_resolved(from_units, from) || !find_resolved(to_units, to)) {
+        string e_message = "Don't know how to convert from " + from_units \
+                           + " to " + to_units;
+        throw invalid_argument(e_message);
+    }
+    return ConversionPlan{from, to, conversion, reader.converter->version()};
+}
+
+/** resolves and stamps against the same pinned version */
+ConversionPlan ConcurrentConverter::plan
+(   unit_id from_units, unit_id to_units   ) const
+{
+    Reader reader(*this);
+    Affine conversion;
+    if (!reader.converter->find_conversion(from_units, to_units,
+                                           conversion)) {
+        string e_message = "Don't know how to convert from " \
+                           + UnitSymbols::name(from_units) + " to " \
+                           + UnitSymbols::name(to_units);
+        throw invalid_argument(e_message);
+    }
+    return ConversionPlan{from_units, to_units, conversion,
+                          reader.converter->version()};
+}
+
+/** compares against the rules version of the published converter */
+bool ConcurrentConverter::is_current(const ConversionPlan &plan) const {
+    Reader reader(*this);
+    return reader.converter->is_current(plan);
+}
+
+/** every publish bumps the epoch exactly once */
+uint64_t ConcurrentConverter::publish_count() const {
+    return epoch.load();
+}
+
+/** a one-change update */
+void ConcurrentConverter::add_conversion
+(   const string &from_units, double multiplier, const string &to_units,
+    double offset
+)
+{
+    update([&](UnitConverter &u) {
+        u.add_conversion(from_units, multiplier, to_units, offset);
+    });
+}
+
+/** copy, modify, publish. the copy is only published if 'change' returns */
+void ConcurrentConverter::update
+(   const function<void(UnitConverter &)> &change   )
+{
+    lock_guard<mutex> lock(writing);
+    UnitConverter *next = new UnitConverter(*current.load());
+    try {
+        change(*next);
+    }
+    catch (...) {
+        delete next;
+        throw;
+    }
+    publish(next);
+}
+
+/** publishes the given rules as they are */
+void ConcurrentConverter::replace(UnitConverter next) {
+    lock_guard<mutex> lock(writing);
+    publish(new UnitConverter(move(next)));
+}
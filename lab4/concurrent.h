@@ -0,0 +1,228 @@
+#ifndef CONCURRENT_HH
+#define CONCURRENT_HH
+
+#include "units.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+using namespace std;
+
+/**
+ * a UnitConverter shared between threads. readers work on an immutable
+ * published version of the rules and never take a lock or write anything
+ * but their own stripe's reader count. writers copy the current version,
+ * change the copy, and publish it with one atomic store; the old version is
+ * deleted once every reader that could still see it has left.
+ *
+ * calls taking unit ids are lock-free. calls taking names also look the
+ * names up in UnitSymbols, which shares a lock between lookups. names are
+ * only interned once they have resolved, and only find_units interns an
+ * expression.
+ */
+class ConcurrentConverter {
+    /** the published version. only ever replaced, never modified */
+    atomic<const UnitConverter *> current;
+    /** bumped on every publish. readers register under its parity, so a
+     *  writer only waits for readers that started before its publish */
+    atomic<uint64_t> epoch;
+
+    /** number of stripes readers are spread over */
+    static const size_t STRIPES = 16;
+    /** reader counts for each epoch parity, padded to a cache line so
+     *  readers on different stripes don't contend */
+    struct alignas(64) Stripe {
+        atomic<size_t> readers[2];
+    };
+    mutable Stripe stripes[STRIPES];
+
+    /** serializes writers */
+    mutex writing;
+
+    /** pins the published version for the lifetime of a read */
+    class Reader;
+
+    /**
+     * publishes a new version and deletes the old one once its readers are
+     * gone. must be called with 'writing' held.
+     * @param the new version, which this object takes ownership of
+     * @return void
+     */
+    void publish(const UnitConverter *next);
+
+    /**
+     * finds the id of a name that has already resolved against the rules.
+     * a plain name, which can only be a unit in the rules or a prefixed
+     * one, is interned; an expression must already be interned, so the
+     * name-based calls can't fill the symbol table with arbitrary text
+     * @param the unit name, and where to store its id
+     * @return false if the name is an expression that was never interned
+     */
+    static bool find_resolved(const string &units, unit_id &id);
+
+public:
+    /**
+     * constructor
+     * @param the rules to start from
+     */
+    ConcurrentConverter(const UnitConverter &initial = UnitConverter());
+
+    /** destructor - no reader may still be running */
+    ~ConcurrentConverter();
+
+    ConcurrentConverter(const ConcurrentConverter &) = delete;
+    ConcurrentConverter &operator=(const ConcurrentConverter &) = delete;
+
+    /** readers */
+    /**
+     * finds the id of a unit name. a name that was never interned is only
+     * interned if it resolves against the published rules, as a prefixed
+     * unit or an expression, so junk names don't grow the symbol table
+     * @param the unit name, and where to store its id
+     * @return false if the name was never interned and doesn't resolve
+     */
+    bool find_units(const string &units, unit_id &id) const;
+
+    /**
+     * resolves the conversion between two interned units
+     * @param the units to convert from and to, and where to store the
+     *         conversion
+     * @return true if the units are convertible
+     */
+    bool find_conversion(unit_id from_units, unit_id to_units,
+                         Affine &conversion) const;
+
+    /**
+     * resolves the conversion between two unit names without interning
+     * either, so it is safe to call with names from untrusted input
+     * @param the units to convert from and to, and where to store the
+     *         conversion
+     * @return true if the units are convertible
+     */
+    bool find_conversion(const string &from_units, const string &to_units,
+                         Affine &conversion) const;
+
+    /**
+     * checks whether two units are connected by the rules
+     * @param the units to convert from and to
+     * @return true if convert_to would succeed for this pair
+     */
+    bool can_convert(const string &from_units, const string &to_units) const;
+
+    /**
+     * convert funtion to convert to 'to_units'
+     * throws invalid_argument if the units are not connected by the rules
+     * @param UValue instance, and a string of the units to convert that
+     *         instance to
+     * @return the new instance of the converted UValue
+     */
+    UValue convert_to(const UValue &input, const string &to_units) const;
+
+    /**
+     * convert funtion to convert to units that are already interned
+     * throws invalid_argument if the units are not connected by the rules
+     * @param UValue instance, and the id of the units to convert to
+     * @return the new instance of the converted UValue
+     */
+    UValue convert_to(const UValue &input, unit_id to_units) const;
+
+    /**
+     * non-throwing version of convert_to. a target that is an expression
+     * must already be interned, as by find_units
+     * @param UValue instance, and a string of the units to convert that
+     *         instance to
+     * @return the converted UValue, or nothing if the units are unknown,
+     *         not connected by the rules, or an expression never interned
+     */
+    optional<UValue> try_convert(const UValue &input,
+                                 const string &to_units) const;
+
+    /**
+     * non-throwing version of convert_to for interned units
+     * @param UValue instance, and the id of the units to convert to
+     * @return the converted UValue, or nothing if the units are unknown or
+     *         not connected by the rules
+     */
+    optional<UValue> try_convert(const UValue &input, unit_id to_units) const;
+
+    /**
+     * converts a whole array of values between two units with the
+     * vectorized kernel. 'in' and 'out' may be the same array.
+     * throws invalid_argument if the units are not connected by the rules
+     * @param the input values, where to write the results, the number of
+     *         values, and the units to convert from and to
+     * @return void
+     */
+    void convert_batch(const double *in, double *out, size_t count,
+                       const string &from_units,
+                       const string &to_units) const;
+
+    /**
+     * resolves a pair of units once, for converting many values later.
+     * the plan keeps working after a publish; is_current tells whether it
+     * still matches the rules. units that are expressions must already be
+     * interned, as by find_units
+     * throws invalid_argument if the units are not connected by the rules
+     * or are an expression never interned
+     * @param the units to convert from and to
+     * @return the plan
+     */
+    ConversionPlan plan(const string &from_units,
+                        const string &to_units) const;
+
+    /**
+     * resolves a pair of interned units once
+     * throws invalid_argument if the units are not connected by the rules
+     * @param the units to convert from and to
+     * @return the plan
+     */
+    ConversionPlan plan(unit_id from_units, unit_id to_units) const;
+
+    /**
+     * checks whether a plan was resolved from the published rules
+     * @param the plan
+     * @return false if rules were added or replaced since it was made
+     */
+    bool is_current(const ConversionPlan &plan) const;
+
+    /**
+     * counts the versions published since construction. this is not the
+     * rules version that ConversionPlan::version and is_current compare
+     * @param void
+     * @return the number of publishes
+     */
+    uint64_t publish_count() const;
+
+    /** writers */
+    /**
+     * adds a conversion and publishes the result as a new version
+     * throws invalid_argument if the conversion already exists, in which
+     * case nothing is published
+     * @param the units to convert from and to, the multiplier, and an
+     *         optional offset added after multiplying
+     * @return void
+     */
+    void add_conversion(const string &from_units, double multiplier,
+                        const string &to_units, double offset = 0);
+
+    /**
+     * applies several changes to a copy of the rules and publishes them as
+     * one version, so readers see either none or all of them. if 'change'
+     * throws, nothing is published and the exception propagates.
+     * @param the function making the changes
+     * @return void
+     */
+    void update(const function<void(UnitConverter &)> &change);
+
+    /**
+     * publishes a whole new set of rules, such as a reloaded rules file
+     * @param the new rules
+     * @return void
+     */
+    void replace(UnitConverter next);
+};
+
+#endif // CONCURRENT_HH
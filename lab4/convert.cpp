@@ -1,46 +1,293 @@
 #include "units.h"
+#include "rules.h"
+#include "reload.h"
+#include "snapshot.h"
+#include <charconv>
 #include <string>
+#include <string_view>
 #include <stdexcept>
+#include <optional>
+#include <type_traits>
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
+#include <vector>
 
 using namespace std;
 
-/** initialize the converter w/ all conversions found in file */
-UnitConverter init_converter(const string filename) {
-    // initialize converter and open file
-    UnitConverter converter;
-    ifstream ifs{filename};
+/** initialize the converter w/ all conversions found in file, which may be
+ *  a text rules file or a snapshot written by --save-snapshot */
+UnitConverter init_converter(const string filename,
+                             const LoadOptions &options = LoadOptions()) {
+    vector<InconsistentRule> inconsistent;
+    UnitConverter u = load_converter(filename, options, &inconsistent);
 
-    // make sure file was opened successfully
-    if (!ifs) {
-        throw invalid_argument("Couldn't open " + filename + "\n");
+    // rules that disagree with a cycle are worth knowing about either way
+    for (const InconsistentRule &r : inconsistent) {
+        cerr << "warning: " << filename << ":" << r.line << ": "
+             << r.from_units << " " << r.given.scale << " " << r.to_units
+             << " disagrees with earlier rules, which give "
+             << r.implied.scale << " (relative error " << r.error << ")"
+             << (options.reject_inconsistent ? ", rule skipped" : "")
+             << "\n";
     }
+    return u;
+}
+
+/** units of the previous record, so runs of the same pair skip the name
+ *  lookups entirely */
+struct LastUnits {
+    /** unit name as it appeared in the input */
+    string name;
+    /** its id in the converter, if it was known */
+    unit_id id;
+    /** whether the converter knows the name at all */
+    bool found = false;
+};
+
+/** resolves a unit name from the input, reusing the previous answer. names
+ *  that weren't found are looked up again, since a reload may add them */
+template <typename Converter>
+bool resolve_units(const Converter &u, string_view name, LastUnits &last) {
+    if ((name != last.name) || !last.found) {
+        last.name.assign(name.data(), name.size());
+        last.found = u.find_units(last.name, last.id);
+    }
+    return last.found;
+}
 
-    // read data until EOF
-    while (ifs) {
-        double multiplier;
-        string from_units, to_units;
+/** splits off the next whitespace-separated field of a record */
+string_view next_field(string_view &rest) {
+    size_t start = rest.find_first_not_of(" \t\r");
+    if (start == string_view::npos) {
+        rest = string_view{};
+        return rest;
+    }
+    size_t end = rest.find_first_of(" \t\r", start);
+    if (end == string_view::npos) {
+        end = rest.size();
+    }
+    string_view field = rest.substr(start, end - start);
+    rest.remove_prefix(end);
+    return field;
+}
 
-        ifs >> from_units >> multiplier >> to_units;
-        converter.add_conversion(from_units, multiplier, to_units);
+/** converts a value between two units found by resolve_units. a mapped
+ *  snapshot numbers units itself, so it converts plain values */
+template <typename Converter>
+optional<double> try_convert(Converter &u, double value, unit_id from,
+                             unit_id to) {
+    if constexpr (is_same<Converter, const MappedSnapshot>::value) {
+        return u.try_convert(value, from, to);
+    }
+    else {
+        optional<UValue> result = u.try_convert(UValue{value, from}, to);
+        return result ? optional<double>(result->get_value()) : nullopt;
     }
+}
+
+/** converts 'value from_units to_units' records until EOF, writing one
+ *  line of output per record. values are written in the shortest form
+ *  that reads back as the same double. output is gathered in a buffer and
+ *  written in large blocks. works with a UnitConverter, a
+ *  ConcurrentConverter whose rules may be reloaded while streaming, or a
+ *  MappedSnapshot.
+ */
+template <typename Converter>
+void stream_conversions(Converter &u, istream &is, ostream &os) {
+    const size_t flush_at = 1 << 16;
+    string out;
+    out.reserve(flush_at + 256);
 
-    return converter;
+    LastUnits from, to;
+    string line;
+    char number[32];
+    size_t line_no = 0;
+
+    while (getline(is, line)) {
+        line_no++;
+        string_view rest{line};
+        string_view value_text = next_field(rest);
+        string_view from_units = next_field(rest);
+        string_view to_units   = next_field(rest);
+
+        // blank lines are skipped silently
+        if (value_text.empty()) {
+            continue;
+        }
+
+        char *value_end;
+        double value = strtod(line.c_str() + (value_text.data() - line.data()),
+                              &value_end);
+        if ((value_end != value_text.data() + value_text.size()) ||
+            to_units.empty() || !next_field(rest).empty()) {
+            out += "error: malformed record on line " + to_string(line_no);
+        }
+        else {
+            optional<double> result;
+            if (resolve_units(u, from_units, from) &&
+                resolve_units(u, to_units, to)) {
+                result = try_convert(u, value, from.id, to.id);
+            }
+
+            if (result) {
+                char *end = to_chars(number, number + sizeof(number),
+                                     *result).ptr;
+                out.append(number, end - number);
+                out += ' ';
+                out.append(to_units.data(), to_units.size());
+            }
+            else {
+                out += "error: Don't know how to convert from ";
+                out.append(from_units.data(), from_units.size());
+                out += " to ";
+                out.append(to_units.data(), to_units.size());
+            }
+        }
+        out += '\n';
+
+        if (out.size() >= flush_at) {
+            os.write(out.data(), out.size());
+            out.clear();
+        }
+    }
+    os.write(out.data(), out.size());
+    os.flush();
+}
+
+/** prints the outcome of a rules reload to stderr */
+void report_reload(const ReloadReport &r) {
+    if (r.ok) {
+        cerr << "reloaded rules: " << r.rules << " rules in "
+             << r.seconds * 1000 << " ms, version " << r.version;
+        if (r.inconsistent != 0) {
+            cerr << ", " << r.inconsistent << " inconsistent";
+        }
+        cerr << "\n";
+    }
+    else {
+        cerr << "reload failed, keeping version " << r.version << ": "
+             << r.error << "\n";
+    }
 }
 
 /** main program will open 'rules.txt' file containing all conversions and use
  * that data to make conversions as prompted by user. Will throw error if user
  * tries to make an invalid conversion (i.e. cannot convert between units, or
  * conversion was not mentioned in 'rules' file)
+ *
+ * options:
+ *   --rules FILE          load FILE instead of 'rules.txt'. it may be a text
+ *                         rules file or a snapshot
+ *   --save-snapshot FILE  write the loaded rules to a binary snapshot and
+ *                         exit. loading the snapshot skips all parsing
+ *   --stream [FILE]       convert 'value from to' records from FILE (or
+ *                         stdin) until EOF, without prompting. a snapshot
+ *                         is read in place, so only the units named in
+ *                         its rules convert, not expressions or prefixes
+ *   --watch               with --stream, reload the rules whenever the
+ *                         rules file changes, without pausing the stream
+ *   --exact               read the rules' numbers as exact decimals, so
+ *                         long chains of rules don't drift
+ *   --check [TOL]         warn about rules that disagree with the cycle
+ *                         they close by more than TOL (default 1e-9)
+ *   --reject-inconsistent with --check, also leave those rules out
  */
-int main() {
+int main(int argc, char **argv) {
     double val;
     string from_units, to_units;
+    string rules_file = "rules.txt", snapshot_file, stream_file;
+    bool stream = false, watch = false;
+    LoadOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if ((arg == "--rules") && (i + 1 < argc)) {
+            rules_file = argv[++i];
+        }
+        else if ((arg == "--save-snapshot") && (i + 1 < argc)) {
+            snapshot_file = argv[++i];
+        }
+        else if (arg == "--stream") {
+            stream = true;
+            if ((i + 1 < argc) && (argv[i + 1][0] != '-')) {
+                stream_file = argv[++i];
+            }
+        }
+        else if (arg == "--watch") {
+            watch = true;
+        }
+        else if (arg == "--exact") {
+            options.exact = true;
+        }
+        else if (arg == "--check") {
+            options.check_cycles = true;
+            if ((i + 1 < argc) && (argv[i + 1][0] != '-')) {
+                options.tolerance = atof(argv[++i]);
+            }
+        }
+        else if (arg == "--reject-inconsistent") {
+            options.reject_inconsistent = true;
+        }
+        else {
+            cerr << "usage: " << argv[0] << " [--rules FILE] "
+                 << "[--save-snapshot FILE] [--stream [FILE]] [--watch] "
+                 << "[--exact] [--check [TOL]] [--reject-inconsistent]\n";
+            return 1;
+        }
+    }
+
+    ifstream ifs;
+    if (stream) {
+        ios::sync_with_stdio(false);
+        cin.tie(nullptr);
+        if (!stream_file.empty()) {
+            ifs.open(stream_file);
+            if (!ifs) {
+                cerr << "Couldn't open " << stream_file << "\n";
+                return 1;
+            }
+        }
+    }
+    istream &is = stream_file.empty() ? cin : ifs;
 
     // try-catch improper file
     try {
-        UnitConverter u = init_converter("rules.txt");
+        // a snapshot is streamed from in place, so startup takes the same
+        // time however many rules it holds
+        if (stream && !watch && snapshot_file.empty() &&
+            UnitConverter::is_snapshot(rules_file)) {
+            const MappedSnapshot rules{rules_file};
+            stream_conversions(rules, is, cout);
+            return 0;
+        }
+
+        UnitConverter u = init_converter(rules_file, options);
+
+        if (!snapshot_file.empty()) {
+            try {
+                u.save_snapshot(snapshot_file);
+            }
+            catch (invalid_argument &e) {
+                cerr << "Couldn't save snapshot: " << e.what() << "\n";
+                return 1;
+            }
+            return 0;
+        }
+
+        if (stream) {
+            if (watch) {
+                // records keep flowing while reloads publish new rules
+                ConcurrentConverter shared(u);
+                RulesWatcher watcher(shared, rules_file, report_reload,
+                                     options);
+                stream_conversions(shared, is, cout);
+            }
+            else {
+                stream_conversions(u, is, cout);
+            }
+            return 0;
+        }
 
         cout << "Enter value with units: ";
         cin >> val >> from_units;
@@ -55,14 +302,20 @@ int main() {
             cout << "Converted to: "
                  << output.get_value() << " " << output.get_units() << "\n";
         }
-        catch (invalid_argument e) {
+        catch (invalid_argument &e) {
             cout << e.what() << "\n";
             // return 1; --wouldn't work on gitlab
         }
     }
 
-    catch (invalid_argument e) {
-        cout << "File could not be opened!\n";
+    catch (invalid_argument &e) {
+        // streams and snapshots are read by other programs, which must see
+        // the failure rather than take the message for output
+        if (stream || !snapshot_file.empty()) {
+            cerr << "Couldn't load rules: " << e.what() << "\n";
+            return 1;
+        }
+        cout << "Couldn't load rules: " << e.what() << "\n";
         // return 1; --wouldnt work on gitlab
     }
 
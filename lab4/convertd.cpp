@@ -0,0 +1,283 @@
+#include "protocol.h"
+#include "reload.h"
+#include "rules.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+/** replies buffered for one client before the server stops reading its
+ *  requests, so a client that never reads can't make it buffer without
+ *  limit */
+static const size_t MAX_BACKLOG = 1 << 20;
+
+/** set by SIGINT/SIGTERM to end the event loop */
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int) {
+    stopping = 1;
+}
+
+/** one client connection and its buffered input and output */
+struct Client {
+    /** the connected socket */
+    int fd;
+    /** bytes received but not yet answered, from 'consumed' onward */
+    string in;
+    /** bytes of 'in' already answered */
+    size_t consumed = 0;
+    /** replies not yet written, from 'sent' onward */
+    string out;
+    /** bytes of 'out' already written */
+    size_t sent = 0;
+    /** the client has shut down its end; the connection closes once the
+     *  last reply is written */
+    bool closing = false;
+    /** the epoll events currently requested */
+    uint32_t events = EPOLLIN;
+};
+
+/** replies written to a client but not yet sent */
+static size_t backlog(const Client &c) {
+    return c.out.size() - c.sent;
+}
+
+/** makes a descriptor non-blocking */
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/** binds and listens on a fresh socket, replacing a stale socket file */
+static int listen_on(const string &path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw invalid_argument("Socket path too long: " + path);
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path.c_str());
+    if ((fd < 0) || (bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0) ||
+        (listen(fd, SOMAXCONN) != 0)) {
+        throw invalid_argument("Couldn't listen on " + path + ": " +
+                               strerror(errno));
+    }
+    set_nonblocking(fd);
+    return fd;
+}
+
+/** writes as much pending output as the socket takes
+ *  @return false if the connection failed */
+static bool flush(Client &c) {
+    while (c.sent < c.out.size()) {
+        ssize_t n = write(c.fd, c.out.data() + c.sent, c.out.size() - c.sent);
+        if (n < 0) {
+            // drop what was sent, so a client that reads slowly can't
+            // keep 'out' growing past the backlog limit
+            c.out.erase(0, c.sent);
+            c.sent = 0;
+            return (errno == EAGAIN) || (errno == EINTR);
+        }
+        c.sent += n;
+    }
+    c.out.clear();
+    c.sent = 0;
+    return true;
+}
+
+/** answers each whole message buffered in 'in'
+ *  @return false if the client sent garbage */
+static bool answer(const ConcurrentConverter &converter, Client &c,
+                   MessageWriter &replies) {
+    size_t length;
+    while (message_length(c.in.data() + c.consumed,
+                          c.in.size() - c.consumed, length)) {
+        if (length - MESSAGE_HEADER > MAX_MESSAGE) {
+            return false;
+        }
+        if (c.in.size() - c.consumed < length) {
+            break;
+        }
+        replies.clear();
+        if (!serve_message(converter, c.in.data() + c.consumed, length,
+                           replies)) {
+            return false;
+        }
+        c.out += replies.finish();
+        c.consumed += length;
+    }
+    c.in.erase(0, c.consumed);
+    c.consumed = 0;
+    return true;
+}
+
+/** reads and answers one buffer at a time until the socket is drained or
+ *  the replies back up, so 'in' never holds more than one message and one
+ *  buffer. all the replies of one call go out in a single write. at end
+ *  of file the messages already received are still answered
+ *  @return false if the connection failed or sent garbage */
+static bool serve(const ConcurrentConverter &converter, Client &c,
+                  MessageWriter &replies) {
+    char buffer[1 << 16];
+    while (!c.closing && (backlog(c) < MAX_BACKLOG)) {
+        ssize_t n = read(c.fd, buffer, sizeof(buffer));
+        if (n == 0) {
+            c.closing = true;
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                return false;
+            }
+            break;
+        }
+        c.in.append(buffer, n);
+        if (!answer(converter, c, replies)) {
+            return false;
+        }
+    }
+    return flush(c);
+}
+
+/** keeps one converter resident and answers conversion requests from
+ *  other processes over a Unix domain socket
+ *
+ * options:
+ *   --rules FILE    load FILE instead of 'rules.txt'. it may be a text
+ *                   rules file or a snapshot
+ *   --socket PATH   listen on PATH instead of 'convertd.sock'
+ *   --watch         reload the rules whenever the rules file changes
+ *   --exact         read the rules' numbers as exact decimals
+ */
+int main(int argc, char **argv) {
+    string rules_file = "rules.txt", socket_path = "convertd.sock";
+    bool watch = false;
+    LoadOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if ((arg == "--rules") && (i + 1 < argc)) {
+            rules_file = argv[++i];
+        }
+        else if ((arg == "--socket") && (i + 1 < argc)) {
+            socket_path = argv[++i];
+        }
+        else if (arg == "--watch") {
+            watch = true;
+        }
+        else if (arg == "--exact") {
+            options.exact = true;
+        }
+        else {
+            cerr << "usage: " << argv[0] << " [--rules FILE] "
+                 << "[--socket PATH] [--watch] [--exact]\n";
+            return 1;
+        }
+    }
+
+    try {
+        ConcurrentConverter converter(load_converter(rules_file, options));
+        unique_ptr<RulesWatcher> watcher;
+        if (watch) {
+            watcher.reset(new RulesWatcher(converter, rules_file,
+                [](const ReloadReport &r) {
+                    cerr << (r.ok ? "reloaded rules: " : "reload failed: ")
+                         << (r.ok ? to_string(r.rules) + " rules" : r.error)
+                         << ", version " << r.version << "\n";
+                }, options));
+        }
+
+        int listener = listen_on(socket_path);
+        int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event event{};
+        event.events  = EPOLLIN;
+        event.data.fd = listener;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &event);
+
+        signal(SIGINT, stop);
+        signal(SIGTERM, stop);
+        signal(SIGPIPE, SIG_IGN);
+
+        unordered_map<int, Client> clients;
+        MessageWriter replies;
+        epoll_event ready[64];
+
+        while (!stopping) {
+            int n = epoll_wait(epoll_fd, ready, 64, -1);
+            for (int i = 0; i < n; i++) {
+                int fd = ready[i].data.fd;
+
+                // a listener wakeup may carry several pending connections
+                if (fd == listener) {
+                    int client;
+                    while ((client = accept4(listener, nullptr, nullptr,
+                                             SOCK_NONBLOCK | SOCK_CLOEXEC))
+                           >= 0) {
+                        event.events  = EPOLLIN;
+                        event.data.fd = client;
+                        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client, &event);
+                        clients[client].fd = client;
+                    }
+                    continue;
+                }
+
+                Client &c = clients[fd];
+                bool ok = true;
+                if (ready[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    ok = serve(converter, c, replies);
+                }
+                else if (ready[i].events & EPOLLOUT) {
+                    // draining the backlog may let reading resume
+                    ok = flush(c) &&
+                         ((backlog(c) >= MAX_BACKLOG) || c.closing ||
+                          serve(converter, c, replies));
+                }
+                if (!ok || (c.closing && c.out.empty())) {
+                    close(fd);
+                    clients.erase(fd);
+                    continue;
+                }
+
+                // read only while the replies aren't backed up and the
+                // client is still sending, and ask for EPOLLOUT only while
+                // there are replies left to write
+                uint32_t wanted =
+                    ((!c.closing && (backlog(c) < MAX_BACKLOG)) ? EPOLLIN : 0) |
+                    (c.out.empty() ? 0 : EPOLLOUT);
+                if (wanted != c.events) {
+                    event.events  = wanted;
+                    event.data.fd = fd;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+                    c.events = wanted;
+                }
+            }
+        }
+
+        for (auto &c : clients) {
+            close(c.first);
+        }
+        close(epoll_fd);
+        close(listener);
+        unlink(socket_path.c_str());
+    }
+    catch (invalid_argument &e) {
+        cerr << "convertd: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
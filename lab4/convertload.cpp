@@ -0,0 +1,235 @@
+#include "protocol.h"
+#include "rules.h"
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+/** what one connection measured */
+struct ConnectionStats {
+    /** round-trip time of every message, in microseconds */
+    vector<double> latencies;
+    /** requests answered with REPLY_OK */
+    size_t converted = 0;
+    /** requests answered with anything else */
+    size_t failed = 0;
+    /** why the connection stopped early, if it did */
+    string error;
+};
+
+/** connects a blocking socket to the server */
+static int connect_to(const string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ((fd < 0) || (connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0)) {
+        throw invalid_argument("Couldn't connect to " + path + ": " +
+                               strerror(errno));
+    }
+    return fd;
+}
+
+/** writes or reads exactly 'length' bytes */
+static bool send_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if ((n < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool receive_all(int fd, char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = read(fd, data, length);
+        if ((n < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+/** sends one message at a time and waits for its reply, until time is up */
+static void run_connection(const string &path, const vector<string> &messages,
+                           double seconds, ConnectionStats &stats) {
+    try {
+        int fd = connect_to(path);
+        string reply;
+        auto stop_at = chrono::steady_clock::now() +
+                       chrono::duration<double>(seconds);
+
+        for (size_t i = 0; chrono::steady_clock::now() < stop_at; i++) {
+            const string &message = messages[i % messages.size()];
+            auto start = chrono::steady_clock::now();
+
+            size_t length;
+            reply.resize(MESSAGE_HEADER);
+            if (!send_all(fd, message.data(), message.size()) ||
+                !receive_all(fd, &reply[0], MESSAGE_HEADER)) {
+                stats.error = "connection closed by server";
+                break;
+            }
+            message_length(reply.data(), reply.size(), length);
+            reply.resize(length);
+            if (!receive_all(fd, &reply[MESSAGE_HEADER],
+                             length - MESSAGE_HEADER)) {
+                stats.error = "connection closed by server";
+                break;
+            }
+
+            chrono::duration<double, micro> elapsed =
+                chrono::steady_clock::now() - start;
+            stats.latencies.push_back(elapsed.count());
+
+            MessageReader replies(reply.data(), reply.size());
+            ReplyStatus status;
+            double value;
+            while (replies.next_reply(status, value)) {
+                if (status == REPLY_OK) {
+                    stats.converted++;
+                }
+                else {
+                    stats.failed++;
+                }
+            }
+        }
+        close(fd);
+    }
+    catch (invalid_argument &e) {
+        stats.error = e.what();
+    }
+}
+
+/** the latency below which a fraction of the sorted samples fall */
+static double percentile(const vector<double> &sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t i = min(sorted.size() - 1, (size_t) (fraction * sorted.size()));
+    return sorted[i];
+}
+
+/** drives convertd with batches of random conversions between units of the
+ *  rules file, and reports latency percentiles and throughput
+ *
+ * options:
+ *   --rules FILE        draw unit names from FILE instead of 'rules.txt'
+ *   --socket PATH       connect to PATH instead of 'convertd.sock'
+ *   --connections N     run N connections at once (default 4)
+ *   --batch N           send N requests per message (default 64)
+ *   --seconds S         run for S seconds (default 5)
+ */
+int main(int argc, char **argv) {
+    string rules_file = "rules.txt", socket_path = "convertd.sock";
+    size_t connections = 4, batch = 64;
+    double seconds = 5;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if ((arg == "--rules") && (i + 1 < argc)) {
+            rules_file = argv[++i];
+        }
+        else if ((arg == "--socket") && (i + 1 < argc)) {
+            socket_path = argv[++i];
+        }
+        else if ((arg == "--connections") && (i + 1 < argc)) {
+            connections = max(1, atoi(argv[++i]));
+        }
+        else if ((arg == "--batch") && (i + 1 < argc)) {
+            batch = max(1, atoi(argv[++i]));
+        }
+        else if ((arg == "--seconds") && (i + 1 < argc)) {
+            seconds = atof(argv[++i]);
+        }
+        else {
+            cerr << "usage: " << argv[0] << " [--rules FILE] "
+                 << "[--socket PATH] [--connections N] [--batch N] "
+                 << "[--seconds S]\n";
+            return 1;
+        }
+    }
+
+    // a fixed set of messages between random pairs of known units
+    vector<string> names;
+    try {
+        UnitConverter u = load_converter(rules_file);
+        for (unit_id id : u.known_units()) {
+            names.push_back(UnitSymbols::name(id));
+        }
+    }
+    catch (invalid_argument &e) {
+        cerr << "Couldn't load rules: " << e.what() << "\n";
+        return 1;
+    }
+    if (names.empty()) {
+        cerr << "No units in " << rules_file << "\n";
+        return 1;
+    }
+    mt19937 rng(18);
+    uniform_int_distribution<size_t> pick(0, names.size() - 1);
+    vector<string> messages;
+    for (int m = 0; m < 64; m++) {
+        MessageWriter w;
+        for (size_t r = 0; r < batch; r++) {
+            w.add_request(r + 1, names[pick(rng)], names[pick(rng)]);
+        }
+        messages.push_back(w.finish());
+    }
+
+    vector<ConnectionStats> stats(connections);
+    vector<thread> threads;
+    for (size_t c = 0; c < connections; c++) {
+        threads.emplace_back(run_connection, socket_path, cref(messages),
+                             seconds, ref(stats[c]));
+    }
+    for (thread &t : threads) {
+        t.join();
+    }
+
+    vector<double> latencies;
+    size_t converted = 0, failed = 0;
+    for (const ConnectionStats &s : stats) {
+        if (!s.error.empty()) {
+            cerr << "connection stopped: " << s.error << "\n";
+        }
+        latencies.insert(latencies.end(), s.latencies.begin(),
+                         s.latencies.end());
+        converted += s.converted;
+        failed += s.failed;
+    }
+    sort(latencies.begin(), latencies.end());
+
+    size_t requests = converted + failed;
+    printf("%zu connections, %zu requests per message\n", connections, batch);
+    printf("messages:   %zu (%.0f/s)\n", latencies.size(),
+           latencies.size() / seconds);
+    printf("requests:   %zu (%.0f/s), %zu not convertible\n", requests,
+           requests / seconds, failed);
+    printf("latency:    p50 %.1f us, p99 %.1f us per message\n",
+           percentile(latencies, 0.50), percentile(latencies, 0.99));
+    return 0;
+}
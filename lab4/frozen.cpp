@@ -0,0 +1,265 @@
+#include "frozen.h"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+/** bytes glibc's malloc sets aside for a request: an 8-byte header, rounded
+ *  up to 16, and never less than 32 */
+size_t heap_block(size_t bytes) {
+    if (bytes == 0) {
+        return 0;
+    }
+    return max<size_t>(32, (bytes + 8 + 15) & ~size_t(15));
+}
+
+/** heap bytes behind a vector */
+template <typename T>
+size_t vector_bytes(const vector<T> &v) {
+    return heap_block(v.capacity() * sizeof(T));
+}
+
+/** heap bytes behind an unordered_map: the bucket array, which isn't
+ *  allocated while there is only one bucket, and one block per entry
+ *  holding the next pointer and the entry */
+template <typename Map>
+size_t hash_map_bytes(const Map &m) {
+    size_t buckets = (m.bucket_count() > 1)
+                     ? heap_block(m.bucket_count() * sizeof(void *)) : 0;
+    return buckets +
+           m.size() * heap_block(sizeof(pair<void *, typename Map::value_type>));
+}
+
+}
+
+/** rows are laid out in id order, each sorted by target so a direct rule
+ *  can be found by binary search */
+FrozenGraph UnitConverter::freeze() const {
+    size_t edges = 0;
+    for (const Node &node : nodes) {
+        edges += node.edges.size();
+    }
+    if (edges > UINT32_MAX) {
+        throw invalid_argument("Too many rules to freeze: " +
+                               to_string(edges / 2));
+    }
+
+    FrozenGraph g;
+    g.rules_version = rules_version;
+    g.first_edge.reserve(nodes.size() + 1);
+    g.target.reserve(edges);
+    g.factor.reserve(edges);
+    g.root.resize(nodes.size());
+    g.root_factor.assign(nodes.size(), 1);
+
+    vector<pair<node_id, Affine>> row;
+    for (node_id id = 0; id < nodes.size(); id++) {
+        const Node &n = nodes[id];
+        g.first_edge.push_back(g.target.size());
+        if (!n.known) {
+            g.root[id] = id;
+            continue;
+        }
+
+        g.root[id]        = n.root;
+        g.root_factor[id] = n.to_root.scale;
+        if (n.to_root.offset != 0) {
+            g.root_offset.emplace_back(id, n.to_root.offset);
+        }
+
+        row.assign(n.edges.begin(), n.edges.end());
+        sort(row.begin(), row.end(),
+             [](const pair<node_id, Affine> &a, const pair<node_id, Affine> &b) {
+                 return a.first < b.first;
+             });
+        for (const auto &edge : row) {
+            if (edge.second.offset != 0) {
+                g.edge_offset.emplace_back(g.target.size(), edge.second.offset);
+            }
+            g.target.push_back(edge.first);
+            g.factor.push_back(edge.second.scale);
+        }
+    }
+    g.first_edge.push_back(g.target.size());
+    return g;
+}
+
+/** every table the converter allocates, as the allocator sizes it */
+GraphMemory UnitConverter::memory_usage() const {
+    GraphMemory m{nodes.size(), 0, 0, vector_bytes(nodes), 0};
+    for (const Node &n : nodes) {
+        m.edges      += n.edges.size();
+        m.edge_bytes += hash_map_bytes(n.edges);
+        m.unit_bytes += vector_bytes(n.members) +
+                        vector_bytes(n.exact_members);
+    }
+
+    m.other_bytes = vector_bytes(stamp) + vector_bytes(parent) +
+                    vector_bytes(reach) + vector_bytes(frontier) +
+                    hash_map_bytes(compounds) + hash_map_bytes(cache) +
+                    lru.size() * heap_block(2 * sizeof(void *) +
+                                            sizeof(lru.front()));
+    for (const auto &c : compounds) {
+        m.other_bytes += vector_bytes(c.second.dims);
+    }
+    return m;
+}
+
+/** nothing in it until UnitConverter::freeze fills the tables */
+FrozenGraph::FrozenGraph() : rules_version(0), generation(0) {
+}
+
+/** binary search of a table sorted by key */
+double FrozenGraph::offset_of
+(   const vector<pair<uint32_t, double>> &table, uint32_t key   )
+{
+    auto it = lower_bound(table.begin(), table.end(), key,
+                          [](const pair<uint32_t, double> &entry, uint32_t k) {
+                              return entry.first < k;
+                          });
+    return ((it != table.end()) && (it->first == key)) ? it->second : 0;
+}
+
+/** binary search of the row, which is sorted by target */
+bool FrozenGraph::find_edge(unit_id from, unit_id to, uint32_t &edge) const {
+    auto begin = target.begin() + first_edge[from];
+    auto end   = target.begin() + first_edge[from + 1];
+    auto it    = lower_bound(begin, end, to);
+    if ((it == end) || (*it != to)) {
+        return false;
+    }
+    edge = it - target.begin();
+    return true;
+}
+
+/** a unit is in some rule exactly when its row has an edge */
+bool FrozenGraph::known(unit_id units) const {
+    return (units < root.size()) &&
+           (first_edge[units] != first_edge[units + 1]);
+}
+
+size_t FrozenGraph::unit_count() const {
+    size_t count = 0;
+    for (unit_id id = 0; id < root.size(); id++) {
+        count += known(id);
+    }
+    return count;
+}
+
+/** every rule is stored as an edge in each direction */
+size_t FrozenGraph::rule_count() const {
+    return target.size() / 2;
+}
+
+uint64_t FrozenGraph::version() const {
+    return rules_version;
+}
+
+/** the same order as UnitConverter::resolve: a direct rule, then the root */
+bool FrozenGraph::find_conversion
+(   unit_id from_units, unit_id to_units, Affine &conversion   ) const
+{
+    if (!known(from_units) || !known(to_units)) {
+        return false;
+    }
+
+    uint32_t edge;
+    if (find_edge(from_units, to_units, edge)) {
+        conversion = Affine{factor[edge], offset_of(edge_offset, edge)};
+        return true;
+    }
+    if (root[from_units] != root[to_units]) {
+        return false;
+    }
+
+    Affine f{root_factor[from_units], offset_of(root_offset, from_units)};
+    Affine t{root_factor[to_units], offset_of(root_offset, to_units)};
+    conversion = Affine{f.scale / t.scale, (f.offset - t.offset) / t.scale};
+    return true;
+}
+
+bool FrozenGraph::can_convert(unit_id from_units, unit_id to_units) const {
+    return known(from_units) && known(to_units) &&
+           (root[from_units] == root[to_units]);
+}
+
+/** converts through find_conversion */
+UValue FrozenGraph::convert_to(const UValue &input, unit_id to_units) const {
+    Affine conversion;
+    if (!find_conversion(input.get_unit_id(), to_units, conversion)) {
+        string e_message = "Don't know how to convert from " \
+                            + input.get_units() + " to " \
+                            + UnitSymbols::name(to_units);
+        throw invalid_argument(e_message);
+    }
+    return UValue{conversion.apply(input.get_value()), to_units};
+}
+
+/** breadth-first search over the rows, stamped like UnitConverter::search */
+vector<unit_id> FrozenGraph::conversion_path
+(   unit_id from_units, unit_id to_units   ) const
+{
+    vector<unit_id> path;
+    // units in the same component are always reachable from each other
+    if (!can_convert(from_units, to_units)) {
+        return path;
+    }
+
+    // the scratch is only allocated once a search needs it
+    if (stamp.size() < root.size()) {
+        stamp.assign(root.size(), 0);
+        parent.resize(root.size());
+        generation = 0;
+    }
+    if (++generation == 0) {
+        fill(stamp.begin(), stamp.end(), 0);
+        generation = 1;
+    }
+
+    frontier.clear();
+    frontier.push_back(from_units);
+    stamp[from_units]  = generation;
+    parent[from_units] = from_units;
+    for (size_t next = 0; next < frontier.size(); next++) {
+        unit_id u = frontier[next];
+        if (u == to_units) {
+            break;
+        }
+        for (uint32_t e = first_edge[u]; e < first_edge[u + 1]; e++) {
+            unit_id v = target[e];
+            if (stamp[v] != generation) {
+                stamp[v]  = generation;
+                parent[v] = u;
+                frontier.push_back(v);
+            }
+        }
+    }
+
+    // walk the parents back to the source, then put them in order
+    for (unit_id u = to_units; u != from_units; u = parent[u]) {
+        path.push_back(u);
+    }
+    path.push_back(from_units);
+    reverse(path.begin(), path.end());
+    return path;
+}
+
+/** the flat tables, the sparse offsets, and any search scratch */
+GraphMemory FrozenGraph::memory_usage() const {
+    GraphMemory m;
+    m.unit_slots  = root.size();
+    m.edges       = target.size();
+    m.edge_bytes  = vector_bytes(first_edge) + vector_bytes(target) +
+                    vector_bytes(factor) + vector_bytes(edge_offset);
+    m.unit_bytes  = vector_bytes(root) + vector_bytes(root_factor) +
+                    vector_bytes(root_offset);
+    m.other_bytes = vector_bytes(stamp) + vector_bytes(parent) +
+                    vector_bytes(frontier);
+    return m;
+}
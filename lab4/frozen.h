@@ -0,0 +1,146 @@
+#ifndef FROZEN_HH
+#define FROZEN_HH
+
+#include "units.h"
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+using namespace std;
+
+/**
+ * a read-only copy of a converter's rules in compressed sparse row form,
+ * for rule sets with millions of units. each stored edge is a unit id and a
+ * multiplier in two flat arrays, and each unit's root and conversion to it
+ * are flat arrays indexed by unit id. there is one allocation per table
+ * rather than one per unit and per edge. offsets are rare, so they are
+ * kept to the side, sorted for binary search.
+ * built with UnitConverter::freeze. lookups change nothing, so any number
+ * of threads may share one; path searches reuse scratch space and may not.
+ */
+class FrozenGraph {
+    friend class UnitConverter;
+
+    /** edges of unit u are [first_edge[u], first_edge[u + 1]), sorted by
+     *  target */
+    vector<uint32_t> first_edge;
+    /** unit each edge converts to */
+    vector<unit_id> target;
+    /** multiplier along each edge */
+    vector<double> factor;
+    /** (edge, offset) for each edge with a non-zero offset, sorted */
+    vector<pair<uint32_t, double>> edge_offset;
+    /** representative unit of each unit's component */
+    vector<unit_id> root;
+    /** multiplier from each unit to its root */
+    vector<double> root_factor;
+    /** (unit, offset) for each unit whose conversion to its root has a
+     *  non-zero offset, sorted */
+    vector<pair<unit_id, double>> root_offset;
+    /** version of the rules it was frozen from */
+    uint64_t rules_version;
+
+    /** breadth-first search scratch, as in UnitConverter */
+    mutable vector<unsigned> stamp;
+    /** unit each visited unit was reached from */
+    mutable vector<unit_id> parent;
+    /** the search frontier */
+    mutable vector<unit_id> frontier;
+    /** generation of the current search */
+    mutable unsigned generation;
+
+    /** constructor - empty, filled in by UnitConverter::freeze */
+    FrozenGraph();
+
+    /**
+     * finds the offset stored for a key in one of the sparse offset tables
+     * @param the table, and the edge or unit
+     * @return the offset, or 0 if the key has none
+     */
+    static double offset_of(const vector<pair<uint32_t, double>> &table,
+                            uint32_t key);
+
+    /**
+     * finds the edge between two units by binary search of the row
+     * @param the two units, and where to store the edge's index
+     * @return true if a rule joins the two units directly
+     */
+    bool find_edge(unit_id from, unit_id to, uint32_t &edge) const;
+
+public:
+    /** methods */
+    /**
+     * checks whether a unit appears in some rule
+     * @param the unit's id
+     * @return true if the unit has at least one edge
+     */
+    bool known(unit_id units) const;
+
+    /**
+     * counts the units that appear in some rule
+     * @param void
+     * @return the number of known units
+     */
+    size_t unit_count() const;
+
+    /**
+     * counts the rules, each counted once for both directions
+     * @param void
+     * @return the number of rules
+     */
+    size_t rule_count() const;
+
+    /**
+     * gets the version of the rules the graph was frozen from
+     * @param void
+     * @return the rules version
+     */
+    uint64_t version() const;
+
+    /**
+     * resolves the conversion between two units in constant time: a rule
+     * given for the pair is used as written, otherwise the conversion goes
+     * through the shared root. gives the same answers as the converter it
+     * was frozen from for units named in the rules, except that exact
+     * rules are only kept rounded. unit expressions aren't parsed
+     * @param the units to convert from and to, and where to store the
+     *         conversion
+     * @return true if the units are convertible
+     */
+    bool find_conversion(unit_id from_units, unit_id to_units,
+                         Affine &conversion) const;
+
+    /**
+     * checks whether two units are connected by the rules
+     * @param the units to convert from and to
+     * @return true if find_conversion would succeed for this pair
+     */
+    bool can_convert(unit_id from_units, unit_id to_units) const;
+
+    /**
+     * converts a value to other units
+     * throws invalid_argument if the units are not connected by the rules
+     * @param UValue instance, and the id of the units to convert to
+     * @return the converted UValue
+     */
+    UValue convert_to(const UValue &input, unit_id to_units) const;
+
+    /**
+     * finds the chain of rules with the fewest steps between two units
+     * @param the units to convert from and to
+     * @return every unit along the chain, starting with from_units and
+     *         ending with to_units, or an empty list if there is none
+     */
+    vector<unit_id> conversion_path(unit_id from_units,
+                                    unit_id to_units) const;
+
+    /**
+     * gets the memory held by the graph's tables
+     * @param void
+     * @return bytes used by the edges, the per-unit tables and the search
+     *         scratch
+     */
+    GraphMemory memory_usage() const;
+};
+
+#endif // FROZEN_HH
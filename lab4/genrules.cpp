@@ -0,0 +1,192 @@
+#include "units.h"
+#include "rules.h"
+#include "rules_hash.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * genrules turns a rules file into a C++ header of constexpr tables, for
+ * use with static_converter.h. it resolves every component up front, so
+ * the tables hold each unit's root and the conversion to it, as a factor
+ * and an offset, each unit's rules in compressed sparse row form, so a
+ * rule given for a pair is used as written, plus a perfect hash of
+ * the unit names built with hash-and-displace: names are grouped into
+ * buckets by rules_hash(name, 0), and each bucket, largest first, gets the
+ * smallest seed that sends all of its names to free slots.
+ */
+
+/** writes a unit name as a C++ string literal */
+string quoted(const string &s) {
+    string out = "\"";
+    for (char c : s) {
+        if ((c == '"') || (c == '\\')) {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+/** finds a seed per bucket so every name gets its own slot */
+void build_hash(const vector<string> &names, vector<uint32_t> &seeds,
+                vector<int> &slots) {
+    size_t buckets = names.size() / 2 + 1;
+    size_t table   = names.size() + names.size() / 4 + 1;
+
+    vector<vector<size_t>> bucket(buckets);
+    for (size_t i = 0; i < names.size(); i++) {
+        bucket[rules_hash(names[i], 0) % buckets].push_back(i);
+    }
+
+    vector<size_t> order(buckets);
+    for (size_t b = 0; b < buckets; b++) {
+        order[b] = b;
+    }
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return bucket[a].size() > bucket[b].size();
+    });
+
+    seeds.assign(buckets, 0);
+    slots.assign(table, -1);
+    for (size_t b : order) {
+        if (bucket[b].empty()) {
+            break;
+        }
+        for (uint32_t seed = 1; ; seed++) {
+            vector<size_t> taken;
+            for (size_t i : bucket[b]) {
+                size_t slot = rules_hash(names[i], seed) % table;
+                if ((slots[slot] != -1) ||
+                    (find(taken.begin(), taken.end(), slot) != taken.end())) {
+                    break;
+                }
+                taken.push_back(slot);
+            }
+            if (taken.size() == bucket[b].size()) {
+                for (size_t k = 0; k < taken.size(); k++) {
+                    slots[taken[k]] = bucket[b][k];
+                }
+                seeds[b] = seed;
+                break;
+            }
+        }
+    }
+}
+
+/** writes the tables for every known unit of the converter */
+void write_header(const UnitConverter &u, const string &source,
+                  ostream &os) {
+    vector<unit_id> ids = u.known_units();
+    if (ids.empty()) {
+        throw invalid_argument(source + " has no rules");
+    }
+
+    // units are numbered by their position in ids
+    vector<string> names;
+    vector<size_t> root(ids.size());
+    vector<Affine> to_root(ids.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        names.push_back(UnitSymbols::name(ids[i]));
+        unit_id r;
+        u.root_of(ids[i], r, to_root[i]);
+        root[i] = lower_bound(ids.begin(), ids.end(), r) - ids.begin();
+    }
+
+    // rules of unit i are [first_edge[i], first_edge[i + 1]), sorted by
+    // target, since ids and their positions sort the same way
+    vector<size_t> first_edge;
+    vector<size_t> target;
+    vector<Affine> rule;
+    for (unit_id id : ids) {
+        first_edge.push_back(target.size());
+        for (const auto &r : u.rules_of(id)) {
+            target.push_back(lower_bound(ids.begin(), ids.end(), r.first) -
+                             ids.begin());
+            rule.push_back(r.second);
+        }
+    }
+    first_edge.push_back(target.size());
+
+    vector<uint32_t> seeds;
+    vector<int> slots;
+    build_hash(names, seeds, slots);
+
+    char number[32];
+    os << "// generated by genrules from " << source << ", do not edit\n"
+       << "#ifndef RULES_TABLE_HH\n#define RULES_TABLE_HH\n\n"
+       << "#include <cstddef>\n#include <cstdint>\n\n"
+       << "namespace rules_table {\n\n"
+       << "constexpr size_t unit_count = " << ids.size() << ";\n\n"
+       << "constexpr const char *names[] = {\n";
+    for (const string &n : names) {
+        os << "    " << quoted(n) << ",\n";
+    }
+    os << "};\n\nconstexpr uint32_t root[] = {\n";
+    for (size_t r : root) {
+        os << "    " << r << ",\n";
+    }
+    os << "};\n\nconstexpr double factor[] = {\n";
+    for (const Affine &t : to_root) {
+        snprintf(number, sizeof(number), "%.17g", t.scale);
+        os << "    " << number << ",\n";
+    }
+    os << "};\n\nconstexpr double offset[] = {\n";
+    for (const Affine &t : to_root) {
+        snprintf(number, sizeof(number), "%.17g", t.offset);
+        os << "    " << number << ",\n";
+    }
+    os << "};\n\nconstexpr uint32_t first_edge[] = {\n";
+    for (size_t e : first_edge) {
+        os << "    " << e << ",\n";
+    }
+    os << "};\n\nconstexpr uint32_t edge_target[] = {\n";
+    for (size_t t : target) {
+        os << "    " << t << ",\n";
+    }
+    os << "};\n\nconstexpr double edge_factor[] = {\n";
+    for (const Affine &r : rule) {
+        snprintf(number, sizeof(number), "%.17g", r.scale);
+        os << "    " << number << ",\n";
+    }
+    os << "};\n\nconstexpr double edge_offset[] = {\n";
+    for (const Affine &r : rule) {
+        snprintf(number, sizeof(number), "%.17g", r.offset);
+        os << "    " << number << ",\n";
+    }
+    os << "};\n\nconstexpr size_t bucket_count = " << seeds.size() << ";\n\n"
+       << "constexpr uint32_t seed[] = {\n";
+    for (uint32_t s : seeds) {
+        os << "    " << s << ",\n";
+    }
+    os << "};\n\nconstexpr size_t slot_count = " << slots.size() << ";\n\n"
+       << "constexpr int32_t slot[] = {\n";
+    for (int s : slots) {
+        os << "    " << s << ",\n";
+    }
+    os << "};\n\n}\n\n#endif // RULES_TABLE_HH\n";
+}
+
+/** usage: genrules RULES_FILE > rules_table.h */
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        cerr << "usage: " << argv[0] << " RULES_FILE > rules_table.h\n";
+        return 1;
+    }
+
+    try {
+        UnitConverter u;
+        load_rules(u, argv[1]);
+        write_header(u, argv[1], cout);
+    }
+    catch (invalid_argument &e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -1,8 +1,21 @@
 #include "testbase.h"
 #include "units.h"
+#include "rules.h"
+#include "static_converter.h"
+#include "quantity.h"
+#include "concurrent.h"
+#include "reload.h"
+#include "protocol.h"
+#include "frozen.h"
+#include "snapshot.h"
 
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <chrono>
 #include <iostream>
+#include <thread>
 
 
 using namespace std;
@@ -142,6 +155,1496 @@ void test_multistep_conversions(TestContext &ctx) {
     }
 
     ctx.result();
+
+    ctx.DESC("try_convert reports impossible conversions without throwing");
+
+    try {
+        optional<UValue> r = u.try_convert({1, "A"}, "C");
+        ctx.CHECK(r.has_value());
+        ctx.CHECK(r->get_value() == 6);
+
+        ctx.CHECK(!u.try_convert({20, "B"}, "F").has_value());
+        ctx.CHECK(!u.try_convert({20, "B"}, "furlong").has_value());
+    }
+    catch (...) {
+        ctx.CHECK(false); // try_convert should never throw
+    }
+
+    ctx.result();
+
+    ctx.DESC("Explicit path search finds chains of rules");
+
+    v = u.convert_to({1, "D"}, "C", set<string>{});  // D -> A -> B -> C
+    ctx.CHECK(epsilon_equals(v.get_value(), 1.2));
+
+    try {
+        // B is the only way from A to C
+        v = u.convert_to({1, "A"}, "C", set<string>{"B"});
+        ctx.CHECK(false);  // This operation should throw!
+    }
+    catch (invalid_argument &) {
+        ctx.CHECK(true);   // Expected exception.
+    }
+
+    ctx.result();
+
+    ctx.DESC("Path search takes the fewest steps");
+
+    ctx.CHECK((u.conversion_path("D", "C") ==
+               vector<string>{"D", "A", "B", "C"}));
+
+    u.add_conversion("D", 1.2, "C");  // shortcut around A and B
+    ctx.CHECK((u.conversion_path("D", "C") == vector<string>{"D", "C"}));
+    ctx.CHECK(u.conversion_path("A", "C").size() == 3);
+    ctx.CHECK(u.conversion_path("B", "F").empty());
+
+    ctx.result();
+}
+
+
+void test_component_conversions(TestContext &ctx) {
+
+    UnitConverter u;
+
+    // two separate chains that are only joined by the last rule
+    u.add_conversion("A", 2, "B");   // 1 A = 2 B
+    u.add_conversion("B", 4, "C");   // 1 B = 4 C
+    u.add_conversion("X", 10, "Y");  // 1 X = 10 Y
+    u.add_conversion("Z", 5, "Y");   // 1 Z = 5 Y
+    u.add_conversion("C", 0.5, "Z"); // 1 C = 0.5 Z
+
+    ctx.DESC("Conversions across merged components");
+
+    try {
+        // A -> B -> C -> Z -> Y -> X
+        UValue v = u.convert_to({1, "A"}, "X");
+        ctx.CHECK(epsilon_equals(v.get_value(), 2.0));
+        ctx.CHECK(v.get_units() == "X");
+
+        v = u.convert_to({2, "X"}, "A");
+        ctx.CHECK(epsilon_equals(v.get_value(), 1.0));
+
+        v = u.convert_to({3, "Z"}, "C");
+        ctx.CHECK(epsilon_equals(v.get_value(), 6.0));
+    }
+    catch (...) {
+        ctx.CHECK(false); // Caught an unexpected exception.
+    }
+
+    ctx.result();
+}
+
+
+void test_conversion_cache(TestContext &ctx) {
+
+    UnitConverter u{2};  // room for only two pairs
+
+    u.add_conversion("A", 2, "B");
+    u.add_conversion("B", 3, "C");
+
+    ctx.DESC("Repeated conversions are answered from the cache");
+
+    u.convert_to({1, "A"}, "C");
+    u.convert_to({2, "A"}, "C");
+    UValue v = u.convert_to({3, "A"}, "C");
+    ctx.CHECK(v.get_value() == 18);
+    ctx.CHECK(u.cache_stats().misses == 1);
+    ctx.CHECK(u.cache_stats().hits == 2);
+
+    ctx.result();
+
+    ctx.DESC("Least recently used pairs are evicted");
+
+    u.convert_to({1, "C"}, "A");
+    u.convert_to({1, "B"}, "C");  // evicts A -> C
+    ctx.CHECK(u.cache_stats().evictions == 1);
+    u.convert_to({1, "A"}, "C");
+    ctx.CHECK(u.cache_stats().misses == 4);
+
+    ctx.result();
+
+    ctx.DESC("A new rule replaces the cached entry for its pair");
+
+    u.clear_cache();
+    v = u.convert_to({1, "A"}, "C");
+    u.add_conversion("A", 7, "C");  // overrides the path through B
+    v = u.convert_to({1, "A"}, "C");
+    ctx.CHECK(v.get_value() == 7);
+    ctx.CHECK(u.cache_stats().misses == 2);
+
+    ctx.result();
+
+    ctx.DESC("Unreachable pairs fail fast and are cached");
+
+    ctx.CHECK(u.can_convert("A", "C"));
+    ctx.CHECK(!u.can_convert("A", "furlong"));
+    ctx.CHECK(!u.can_convert("furlong", "furlong"));
+
+    u.add_conversion("E", 2, "D");  // known, but not connected to A
+    for (int i = 0; i < 2; i++) {
+        try {
+            u.convert_to({1, "A"}, "D");
+            ctx.CHECK(false);  // If no exception, it's a failure
+        }
+        catch (invalid_argument &) {
+            ctx.CHECK(true);   // Expected exception.
+        }
+    }
+    ctx.CHECK(u.cache_stats().misses == 3);
+    ctx.CHECK(u.cache_stats().hits == 1);
+
+    // joining the components makes the cached failure stale
+    u.add_conversion("C", 4, "D");
+    ctx.CHECK(u.can_convert("A", "D"));
+    v = u.convert_to({1, "B"}, "D");  // B -> C -> D
+    ctx.CHECK(epsilon_equals(v.get_value(), 12.0));
+
+    ctx.result();
+
+    ctx.DESC("A name that becomes a unit drops its cached pairs");
+
+    UnitConverter w;
+    w.add_conversion("m", 100, "cm");
+    ctx.CHECK(epsilon_equals(w.convert_to({1, "km"}, "cm").get_value(), 1e5));
+    ctx.CHECK(epsilon_equals(w.convert_to({1, "cm"}, "km").get_value(), 1e-5));
+    w.add_conversion("s", 60, "tick");
+    w.add_conversion("km", 5, "m");
+    ctx.CHECK(w.convert_to({1, "km"}, "cm").get_value() == 500);
+    ctx.CHECK(w.convert_to({500, "cm"}, "km").get_value() == 1);
+    ctx.CHECK(w.convert_to({1, "m"}, "cm").get_value() == 100);
+
+    // expressions parsed through the name are dropped too
+    UnitConverter x;
+    x.add_conversion("m", 100, "cm");
+    x.add_conversion("h", 3600, "s");
+    ctx.CHECK(epsilon_equals(x.convert_to({1, "km/h"}, "m/s").get_value(),
+                             1 / 3.6));
+    x.add_conversion("km", 5, "m");
+    ctx.CHECK(epsilon_equals(x.convert_to({1, "km/h"}, "m/s").get_value(),
+                             5 / 3600.0));
+    ctx.CHECK(epsilon_equals(x.convert_to({1, "m/s"}, "km/h").get_value(),
+                             720));
+
+    ctx.result();
+}
+
+
+void test_interned_units(TestContext &ctx) {
+    ctx.DESC("Unit names are interned to one id each");
+
+    UValue a{1, "parsec"};
+    UValue b{2, string("par") + "sec"};
+    ctx.CHECK(a.get_unit_id() == b.get_unit_id());
+    ctx.CHECK(a.get_units() == "parsec");
+    ctx.CHECK(UnitSymbols::name(a.get_unit_id()) == "parsec");
+
+    unit_id id;
+    ctx.CHECK(UnitSymbols::find("parsec", id) && (id == a.get_unit_id()));
+    ctx.CHECK(!UnitSymbols::find("no such unit", id));
+
+    ctx.result();
+
+    ctx.DESC("Conversions between interned units");
+
+    UnitConverter u;
+    u.add_conversion("parsec", 3.26156, "ly");
+
+    unit_id ly = UnitSymbols::intern("ly");
+    UValue v = u.convert_to(a, ly);
+    ctx.CHECK(v.get_unit_id() == ly);
+    ctx.CHECK(v.get_value() == 3.26156);
+    ctx.CHECK(!u.try_convert(a, UnitSymbols::intern("furlong")).has_value());
+
+    ctx.result();
+}
+
+
+void test_batch_conversion(TestContext &ctx) {
+    ctx.DESC("Batch conversion of arrays");
+
+    UnitConverter u;
+    u.add_conversion("km", 1000, "m");
+    u.add_conversion("m", 100, "cm");
+
+    // an odd length exercises the scalar tail of the vector kernels
+    vector<double> in(37), out(37);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = i * 0.5;
+    }
+
+    u.convert_batch(in.data(), out.data(), in.size(), "km", "cm");
+    bool all_ok = true;
+    for (size_t i = 0; i < in.size(); i++) {
+        all_ok = all_ok && epsilon_equals(out[i], in[i] * 100000);
+    }
+    ctx.CHECK(all_ok);
+
+    // in place, back to where we started
+    u.convert_batch(out, "cm", "km");
+    all_ok = true;
+    for (size_t i = 0; i < in.size(); i++) {
+        all_ok = all_ok && epsilon_equals(out[i], in[i]);
+    }
+    ctx.CHECK(all_ok);
+
+    try {
+        u.convert_batch(out, "km", "furlong");
+        ctx.CHECK(false);  // This operation should throw!
+    }
+    catch (invalid_argument &) {
+        ctx.CHECK(true);   // Expected exception.
+    }
+
+    ctx.result();
+}
+
+
+/*! Writes a scratch rules file for the loader tests. */
+void write_rules(const string &filename, const string &text) {
+    ofstream ofs{filename};
+    ofs << text;
+}
+
+
+void test_rules_loader(TestContext &ctx) {
+    const string filename = "test-rules.tmp";
+
+    ctx.DESC("Rules files are loaded line by line");
+
+    UnitConverter u;
+    write_rules(filename, "km 1000 m\n\n  m\t100 cm\r\nft 12 in");
+    ctx.CHECK(load_rules(u, filename) == 3);
+    ctx.CHECK(epsilon_equals(u.convert_to({2, "km"}, "cm").get_value(), 2e5));
+    ctx.CHECK(u.convert_to({1, "ft"}, "in").get_value() == 12);
+
+    ctx.result();
+
+    ctx.DESC("Bad rules are reported with their line number");
+
+    const char *bad[] = {
+        "km 1000 m\nm 100\n",          // missing field
+        "km 1000 m\nm 1e2x cm\n",      // bad number
+        "km 1000 m\nm 100 cm extra\n", // extra field
+        "km 1000 m\n\nkm 1000 m\n",     // duplicate, on line 3
+        "km 1000 m\nA nan B\n",        // not a number
+        "km 1000 m\nC inf D\n",        // infinite
+        "km 1000 m\nC -infinity D\n",  // infinite
+        "km 1000 m\nC 1.8 F inf\n",    // infinite offset
+        "km 1000 m\nE 1/2/3 F\n",      // more than one fraction bar
+        "km 1000 m\nE 1/0 F\n",        // division by zero
+    };
+    const char *where[] = { ":2:", ":2:", ":2:", ":3:", ":2:", ":2:", ":2:",
+                            ":2:", ":2:", ":2:" };
+
+    for (int i = 0; i < 10; i++) {
+        UnitConverter v;
+        write_rules(filename, bad[i]);
+        try {
+            load_rules(v, filename);
+            ctx.CHECK(false);  // This operation should throw!
+        }
+        catch (invalid_argument &e) {
+            ctx.CHECK(string(e.what()).find(where[i]) != string::npos);
+        }
+    }
+
+    try {
+        load_rules(u, "no-such-rules-file");
+        ctx.CHECK(false);  // This operation should throw!
+    }
+    catch (invalid_argument &) {
+        ctx.CHECK(true);   // Expected exception.
+    }
+
+    remove(filename.c_str());
+    ctx.result();
+}
+
+
+void test_snapshots(TestContext &ctx) {
+    const string filename = "test-snapshot.tmp";
+
+    UnitConverter u;
+    u.add_conversion("mile", 1760, "yd");
+    u.add_conversion("yd", 3, "ft");
+    u.add_conversion("ft", 12, "in");
+    u.add_conversion("hr", 60, "min");
+
+    ctx.DESC("Snapshots round-trip the rules");
+
+    u.save_snapshot(filename);
+    ctx.CHECK(UnitConverter::is_snapshot(filename));
+    ctx.CHECK(!UnitConverter::is_snapshot("rules.txt"));
+
+    UnitConverter v = UnitConverter::load_snapshot(filename);
+    ctx.CHECK(v.convert_to({1, "yd"}, "ft").get_value() == 3);
+    ctx.CHECK(epsilon_equals(v.convert_to({1, "mile"}, "in").get_value(),
+                             63360));
+    ctx.CHECK(v.can_convert("min", "hr"));
+    ctx.CHECK(!v.can_convert("min", "in"));
+    ctx.CHECK((v.conversion_path("in", "yd") ==
+               vector<string>{"in", "ft", "yd"}));
+
+    // rules added after loading merge into the loaded components
+    v.add_conversion("hr", 1.0 / 24, "day");
+    ctx.CHECK(epsilon_equals(v.convert_to({1, "day"}, "min").get_value(),
+                             1440));
+
+    ctx.result();
+
+    ctx.DESC("Mapped snapshots answer as the converter does");
+
+    // every pair of the rules in rules.txt, read from the file in place
+    UnitConverter w;
+    load_rules(w, "rules.txt");
+    w.save_snapshot(filename);
+    {
+        const MappedSnapshot m{filename};
+        ctx.CHECK(m.verify());
+        ctx.CHECK(m.unit_count() == w.known_units().size());
+        ctx.CHECK(m.rule_count() == w.rule_count());
+
+        bool all_ok = true;
+        for (unit_id from : w.known_units()) {
+            for (unit_id to : w.known_units()) {
+                unit_id a = 0, b = 0;
+                all_ok = all_ok && m.find_units(UnitSymbols::name(from), a) &&
+                         m.find_units(UnitSymbols::name(to), b);
+
+                Affine expect, got;
+                bool convertible = w.find_conversion(from, to, expect);
+                all_ok = all_ok &&
+                         (m.find_conversion(a, b, got) == convertible);
+                if (convertible) {
+                    all_ok = all_ok && (got.scale == expect.scale) &&
+                             (got.offset == expect.offset) &&
+                             (*m.try_convert(2.5, a, b) ==
+                              expect.apply(2.5));
+                }
+            }
+        }
+        ctx.CHECK(all_ok);
+
+        unit_id id;
+        size_t interned = UnitSymbols::size();
+        ctx.CHECK(!m.find_units("furlong-per-fortnight", id));
+        ctx.CHECK(UnitSymbols::size() == interned);
+        ctx.CHECK(!m.try_convert(1, 0, m.unit_count()));
+    }
+
+    ctx.result();
+
+    ctx.DESC("Damaged snapshots are rejected");
+
+    {
+        fstream f{filename, ios::in | ios::out | ios::binary};
+        f.seekp(-1, ios::end);
+        f.put('?');
+    }
+    try {
+        UnitConverter::load_snapshot(filename);
+        ctx.CHECK(false);  // This operation should throw!
+    }
+    catch (invalid_argument &) {
+        ctx.CHECK(true);   // Expected exception.
+    }
+    // opening in place leaves the checksum to verify
+    ctx.CHECK(!MappedSnapshot{filename}.verify());
+
+    // a header whose edge count makes the table sizes wrap to nothing, on
+    // a file holding only two units and no edges at all
+    {
+        ofstream f{filename, ios::binary | ios::trunc};
+        uint32_t version = 3, units = 2;
+        uint64_t edges = (uint64_t) 1 << 62, name_bytes = 2, slots = 4;
+        uint64_t checksum = 0;
+        f.write("UNITSNAP", 8);
+        f.write(reinterpret_cast<const char *>(&version), 4);
+        f.write(reinterpret_cast<const char *>(&units), 4);
+        f.write(reinterpret_cast<const char *>(&edges), 8);
+        f.write(reinterpret_cast<const char *>(&name_bytes), 8);
+        f.write(reinterpret_cast<const char *>(&slots), 8);
+        f.write(reinterpret_cast<const char *>(&checksum), 8);
+        double factor_offset[4] = { 1, 1, 0, 0 };
+        f.write(reinterpret_cast<const char *>(factor_offset), 32);
+        uint32_t tables[] = { 0, 0,                    // root
+                              0, 1000000, 2000000,     // first_edge
+                              0, 1, 2,                 // name_start
+                              0, 1, UINT32_MAX, UINT32_MAX };  // slot
+        f.write(reinterpret_cast<const char *>(tables), sizeof(tables));
+        f.write("ab", 2);
+    }
+    for (int i = 0; i < 2; i++) {
+        try {
+            if (i == 0) {
+                MappedSnapshot{filename};
+            }
+            else {
+                UnitConverter::load_snapshot(filename);
+            }
+            ctx.CHECK(false);  // This operation should throw!
+        }
+        catch (invalid_argument &) {
+            ctx.CHECK(true);   // Expected exception.
+        }
+    }
+
+    remove(filename.c_str());
+    ctx.result();
+}
+
+
+void test_static_converter(TestContext &ctx) {
+    ctx.DESC("Generated tables agree with rules.txt");
+
+    // lookups in the generated tables happen at compile time
+    static_assert(StaticConverter::find("A") >= 0, "A is in rules.txt");
+    static_assert(StaticConverter::find("furlong") < 0, "furlong is not");
+    static_assert(StaticConverter::can_convert("A", "E"), "A and E connect");
+    static_assert(!StaticConverter::can_convert("A", "H"), "A and H don't");
+
+    UnitConverter u;
+    load_rules(u, "rules.txt");
+
+    // the tables give the same answers as the converter for every pair,
+    // rules given directly included
+    bool all_ok = true;
+    for (unit_id from : u.known_units()) {
+        for (unit_id to : u.known_units()) {
+            const string &f = UnitSymbols::name(from);
+            const string &t = UnitSymbols::name(to);
+            Affine conversion;
+            bool convertible = u.find_conversion(from, to, conversion);
+
+            optional<double> m = StaticConverter::multiplier(f, t);
+            optional<double> c = StaticConverter::convert(3.7, f, t);
+            all_ok = all_ok && (m.has_value() == convertible) &&
+                     (c.has_value() == convertible);
+            if (convertible) {
+                all_ok = all_ok && (*m == conversion.scale) &&
+                         (*c == u.convert_to({3.7, f}, t).get_value());
+            }
+        }
+    }
+    ctx.CHECK(all_ok);
+    static_assert(*StaticConverter::multiplier("E", "A") == 0.01905,
+                  "E to A is a rule of its own");
+    ctx.CHECK(epsilon_equals(*StaticConverter::convert(2, "F", "G"), 82));
+
+    ctx.result();
+}
+
+
+void test_quantities(TestContext &ctx) {
+    ctx.DESC("Compile-time quantities convert with constant factors");
+
+    static_assert(quantity_cast<inches>(feet{1}).value() == 12,
+                  "1 ft = 12 in");
+    static_assert(feet{3} == inches{36}, "3 ft = 36 in");
+    static_assert(kilometers{1} > miles{0.6}, "1 km > 0.6 mi");
+    static_assert(feet{1} <= inches{12} && feet{1} >= inches{12},
+                  "1 ft is both <= and >= 12 in");
+    static_assert(!(meters{1} <= centimeters{99}), "1 m > 99 cm");
+    static_assert(minutes{1} >= seconds{59}, "1 min >= 59 s");
+    static_assert((meters{1} + centimeters{50}).value() == 1.5,
+                  "sums take the scale of the left-hand side");
+
+    // meters{1} + seconds{1} would not compile
+    auto speed = kilometers{90} / hours{1};
+    Quantity<Velocity> mps = speed;
+    ctx.CHECK(epsilon_equals(mps.value(), 25));
+    ctx.CHECK(epsilon_equals(pounds{kilograms{1}}.value(), 2.20462262));
+
+    ctx.result();
+
+    ctx.DESC("Quantities bridge to runtime UValues");
+
+    UnitConverter u;
+    u.add_conversion("ft", 12, "in");
+    u.add_conversion("yd", 3, "ft");
+
+    UValue v = to_uvalue(feet{6}, "ft");
+    ctx.CHECK(u.convert_to(v, "yd").get_value() == 2);
+
+    inches i = from_uvalue<inches>(UValue{2, "yd"}, u, "in");
+    ctx.CHECK(epsilon_equals(i.value(), 72));
+    ctx.CHECK(epsilon_equals(quantity_cast<meters>(i).value(), 1.8288));
+
+    ctx.result();
+}
+
+
+void test_compound_units(TestContext &ctx) {
+    UnitConverter u;
+    u.add_conversion("km", 1000, "m");
+    u.add_conversion("h", 60, "min");
+    u.add_conversion("min", 60, "s");
+    u.add_conversion("kg", 1000, "g");
+
+    ctx.DESC("Compound unit expressions convert by dimension");
+
+    UValue v = u.convert_to({36, "km/h"}, "m/s");
+    ctx.CHECK(epsilon_equals(v.get_value(), 10));
+    ctx.CHECK(v.get_units() == "m/s");
+
+    // 1 kg*m^2/s^2 = 1000 g * (1/1000 km)^2 * (3600 s/h)^2
+    v = u.convert_to({1, "kg*m^2/s^2"}, "g*km^2/h^2");
+    ctx.CHECK(epsilon_equals(v.get_value(), 12960));
+
+    ctx.CHECK(u.can_convert("m/s", "km/h"));
+    ctx.CHECK(u.can_convert("1/s", "h^-1"));
+    ctx.CHECK(epsilon_equals(u.convert_to({1, "1/s"}, "h^-1").get_value(),
+                             3600));
+    ctx.CHECK(!u.can_convert("m/s", "m"));
+    ctx.CHECK(!u.can_convert("m//s", "m/s"));
+    ctx.CHECK(!u.can_convert("m/parsec", "m/s"));
+    ctx.CHECK(!u.try_convert({1, "m/s"}, "kg/s").has_value());
+
+    ctx.result();
+
+    ctx.DESC("Compound conversions are cached like atomic ones");
+
+    u.clear_cache();
+    u.convert_to({1, "km/h"}, "m/s");
+    u.convert_to({2, "km/h"}, "m/s");
+    ctx.CHECK(u.cache_stats().hits == 1);
+
+    // a new rule connects a unit the expression could not resolve before
+    ctx.CHECK(!u.can_convert("ft/s", "m/s"));
+    u.add_conversion("ft", 0.3048, "m");
+    ctx.CHECK(epsilon_equals(u.convert_to({1, "ft/s"}, "m/s").get_value(),
+                             0.3048));
+
+    ctx.result();
+}
+
+
+void test_affine_conversions(TestContext &ctx) {
+    UnitConverter u;
+    u.add_conversion("C", 1.8, "F", 32);     // F = 1.8 C + 32
+    u.add_conversion("K", 1, "C", -273.15);  // C = K - 273.15
+    u.add_conversion("F", 1, "R", 459.67);   // R = F + 459.67
+
+    ctx.DESC("Conversions with offsets compose along paths");
+
+    ctx.CHECK(epsilon_equals(u.convert_to({100, "C"}, "F").get_value(), 212));
+    ctx.CHECK(epsilon_equals(u.convert_to({212, "F"}, "C").get_value(), 100));
+    ctx.CHECK(epsilon_equals(u.convert_to({0, "K"}, "F").get_value(),
+                             -459.67));
+    ctx.CHECK(epsilon_equals(u.convert_to({0, "R"}, "K").get_value(), 0));
+    ctx.CHECK(epsilon_equals(u.convert_to({-40, "F"}, "C").get_value(), -40));
+    ctx.CHECK(epsilon_equals(
+        u.convert_to({300, "K"}, "R", set<string>{}).get_value(), 540));
+
+    ctx.result();
+
+    ctx.DESC("Batch conversion applies the offset too");
+
+    vector<double> temps{-40, 0, 37, 100, -273.15, 20, 25, 30, 35, 1000};
+    vector<double> expect = temps;
+    u.convert_batch(temps, "C", "F");
+    bool all_ok = true;
+    for (size_t i = 0; i < temps.size(); i++) {
+        all_ok = all_ok && epsilon_equals(temps[i], expect[i] * 1.8 + 32);
+    }
+    ctx.CHECK(all_ok);
+
+    // every kernel, and the scalar tail, rounds as converting one value at
+    // a time does
+    vector<double> many(37);
+    for (size_t i = 0; i < many.size(); i++) {
+        many[i] = i * 0.37 - 11.1;
+    }
+    vector<double> converted = many;
+    u.convert_batch(converted, "C", "F");
+    all_ok = true;
+    for (size_t i = 0; i < many.size(); i++) {
+        double one = u.convert_to({many[i], "C"}, "F").get_value();
+        all_ok = all_ok && (converted[i] == one);
+    }
+    ctx.CHECK(all_ok);
+
+    ctx.result();
+
+    ctx.DESC("Snapshots keep the offsets");
+
+    u.save_snapshot("test-snapshot.tmp");
+    UnitConverter v = UnitConverter::load_snapshot("test-snapshot.tmp");
+    remove("test-snapshot.tmp");
+    ctx.CHECK(epsilon_equals(v.convert_to({37, "C"}, "F").get_value(), 98.6));
+    ctx.CHECK(epsilon_equals(v.convert_to({0, "K"}, "R").get_value(), 0));
+
+    ctx.result();
+}
+
+
+/*!
+ * Test the converter shared between reader and writer threads
+ */
+void test_concurrent_converter(TestContext &ctx) {
+    UnitConverter u;
+    u.add_conversion("mi", 5280, "ft");
+    u.add_conversion("ft", 12, "in");
+    u.convert_to({1, "mi"}, "in");
+
+    ctx.DESC("Copies keep the rules but start with an empty cache");
+
+    UnitConverter copy = u;
+    ctx.CHECK(copy.cache_stats().hits == 0);
+    ctx.CHECK(copy.cache_stats().misses == 0);
+    ctx.CHECK(copy.convert_to({1, "mi"}, "in").get_value() == 63360);
+    copy.add_conversion("yd", 3, "ft");
+    ctx.CHECK(!u.can_convert("yd", "in"));
+    u = copy;
+    ctx.CHECK(u.convert_to({2, "yd"}, "in").get_value() == 72);
+
+    ctx.result();
+
+    ctx.DESC("Each change publishes a new version");
+
+    ConcurrentConverter shared(u);
+    ctx.CHECK(shared.publish_count() == 0);
+    ctx.CHECK(shared.convert_to({1, "mi"}, "ft").get_value() == 5280);
+    ctx.CHECK(shared.can_convert("mi/ft", "in/yd"));
+    ctx.CHECK(!shared.try_convert({1, "mi"}, "furlong").has_value());
+
+    shared.add_conversion("furlong", 660, "ft");
+    ctx.CHECK(shared.publish_count() == 1);
+    ctx.CHECK(shared.convert_to({8, "furlong"}, "mi").get_value() == 1);
+
+    shared.update([](UnitConverter &v) {
+        v.add_conversion("chain", 66, "ft");
+        v.add_conversion("rod", 16.5, "ft");
+    });
+    ctx.CHECK(shared.publish_count() == 2);
+    ctx.CHECK(shared.convert_to({4, "rod"}, "chain").get_value() == 1);
+
+    // a failed update publishes nothing
+    try {
+        shared.update([](UnitConverter &v) {
+            v.add_conversion("league", 3, "mi");
+            v.add_conversion("ft", 12, "in");
+        });
+        ctx.CHECK(false);
+    }
+    catch (invalid_argument &e) {
+        ctx.CHECK(shared.publish_count() == 2);
+        ctx.CHECK(!shared.can_convert("league", "mi"));
+    }
+
+    shared.replace(UnitConverter());
+    ctx.CHECK(shared.publish_count() == 3);
+    ctx.CHECK(!shared.can_convert("mi", "ft"));
+
+    ctx.result();
+
+    ctx.DESC("Names that don't resolve are never interned");
+
+    shared.replace(u);
+    size_t symbols = UnitSymbols::size();
+    unit_id id;
+    Affine conversion;
+    for (int i = 0; i < 100; i++) {
+        string junk = "junk" + to_string(i) + "*zz";
+        ctx.CHECK(!shared.can_convert(junk, "ft"));
+        ctx.CHECK(!shared.find_units(junk, id));
+        ctx.CHECK(!shared.find_conversion("k" + junk, "ft", conversion));
+        ctx.CHECK(!shared.try_convert({1, "ft"}, junk).has_value());
+    }
+    ctx.CHECK(UnitSymbols::size() == symbols);
+    ctx.CHECK(shared.find_conversion("mi/in", "ft/ft", conversion));
+    ctx.CHECK(conversion.scale == 63360);
+    ctx.CHECK(UnitSymbols::size() == symbols);
+    ctx.CHECK(shared.find_units("in*in*in*in", id));
+    ctx.CHECK(UnitSymbols::name(id) == "in*in*in*in");
+
+    // expressions that resolve aren't interned by converting to them either
+    symbols = UnitSymbols::size();
+    for (int i = 1; i <= 1000; i++) {
+        string scaled = to_string(i) + ".25*ft";
+        ctx.CHECK(!shared.try_convert({1, "ft"}, scaled).has_value());
+        try {
+            shared.plan("ft", scaled);
+            ctx.CHECK(false);
+        }
+        catch (invalid_argument &e) {
+            ctx.CHECK(true);
+        }
+    }
+    ctx.CHECK(UnitSymbols::size() == symbols);
+    ctx.CHECK(shared.find_units("12*in", id));
+    ctx.CHECK(shared.try_convert({2, "ft"}, "12*in")->get_value() == 2);
+    ctx.CHECK(shared.plan("12*in", "ft")(3) == 3);
+
+    ctx.result();
+
+    ctx.DESC("Readers see consistent versions while a writer publishes");
+
+    ConcurrentConverter live(u);
+    unit_id in = UnitSymbols::intern("in");
+    atomic<size_t> wrong{0};
+    atomic<bool> done{false};
+    vector<thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&]() {
+            while (!done) {
+                optional<UValue> v = live.try_convert({1, "mi"}, in);
+                if (!v || (v->get_value() != 63360)) {
+                    wrong++;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 200; i++) {
+        live.add_conversion("step" + to_string(i), i + 1, "ft");
+    }
+    done = true;
+    for (thread &r : readers) {
+        r.join();
+    }
+    ctx.CHECK(wrong == 0);
+    ctx.CHECK(live.publish_count() == 200);
+    ctx.CHECK(live.convert_to({1, "step199"}, "in").get_value() == 2400);
+
+    ctx.result();
+}
+
+
+/*!
+ * Test reloading the rules file while the converter is in use
+ */
+void test_rules_reload(TestContext &ctx) {
+    write_rules("test-reload.tmp", "mi 5280 ft\n");
+    ConcurrentConverter shared(load_converter("test-reload.tmp"));
+    mutex lock;
+    vector<ReloadReport> reports;
+    RulesWatcher watcher(shared, "test-reload.tmp",
+                         [&](const ReloadReport &r) {
+                             lock_guard<mutex> guard(lock);
+                             reports.push_back(r);
+                         });
+
+    // waits for the watcher thread to report on a change
+    auto wait_for = [&](size_t count) {
+        for (int i = 0; i < 500; i++) {
+            {
+                lock_guard<mutex> guard(lock);
+                if (reports.size() >= count) {
+                    return true;
+                }
+            }
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        return false;
+    };
+
+    ctx.DESC("Writing the rules file publishes the new rules");
+
+    write_rules("test-reload.tmp", "mi 5280 ft\nft 12 in\nyd 3 ft\n");
+    ctx.CHECK(wait_for(1));
+    ctx.CHECK(reports[0].ok);
+    ctx.CHECK(reports[0].rules == 3);
+    ctx.CHECK(reports[0].version == 1);
+    ctx.CHECK(reports[0].seconds >= 0);
+    ctx.CHECK(shared.convert_to({1, "yd"}, "in").get_value() == 36);
+
+    ctx.result();
+
+    ctx.DESC("A bad rules file keeps the current version");
+
+    write_rules("test-reload.tmp", "mi 5280 ft\nft twelve in\n");
+    ctx.CHECK(wait_for(2));
+    ctx.CHECK(!reports[1].ok);
+    ctx.CHECK(reports[1].error.find(":2:") != string::npos);
+    ctx.CHECK(shared.publish_count() == 1);
+    ctx.CHECK(shared.convert_to({1, "yd"}, "in").get_value() == 36);
+
+    write_rules("test-reload.tmp", "");
+    ctx.CHECK(wait_for(3));
+    ctx.CHECK(!reports[2].ok);
+    ctx.CHECK(shared.can_convert("mi", "in"));
+
+    ctx.result();
+
+    ctx.DESC("Reloads can also be asked for directly");
+
+    write_rules("test-reload.tmp", "furlong 660 ft\n");
+    ReloadReport r = watcher.reload_now();
+    ctx.CHECK(r.ok && (r.rules == 1));
+    ctx.CHECK(shared.can_convert("furlong", "ft"));
+    ctx.CHECK(!shared.can_convert("mi", "ft"));
+
+    ctx.result();
+    remove("test-reload.tmp");
+}
+
+
+/*!
+ * Test the convertd wire protocol without a socket
+ */
+void test_daemon_protocol(TestContext &ctx) {
+    UnitConverter u;
+    u.add_conversion("mi", 5280, "ft");
+    u.add_conversion("C", 1.8, "F", 32);
+    ConcurrentConverter converter(u);
+
+    ctx.DESC("Requests are answered in order, one reply each");
+
+    MessageWriter requests;
+    requests.add_request(2, "mi", "ft");
+    requests.add_request(100, "C", "F");
+    requests.add_request(1, "mi", "F");
+    requests.add_request(1, "parsec", "ft");
+    const string &message = requests.finish();
+
+    size_t length;
+    ctx.CHECK(!message_length(message.data(), 4, length));
+    ctx.CHECK(message_length(message.data(), message.size(), length));
+    ctx.CHECK(length == message.size());
+
+    MessageWriter replies;
+    ctx.CHECK(serve_message(converter, message.data(), length, replies));
+    const string &answer = replies.finish();
+    MessageReader reader(answer.data(), answer.size());
+    ctx.CHECK(reader.size() == 4);
+
+    ReplyStatus status;
+    double value;
+    ctx.CHECK(reader.next_reply(status, value) && (status == REPLY_OK) &&
+              (value == 10560));
+    ctx.CHECK(reader.next_reply(status, value) && (status == REPLY_OK) &&
+              epsilon_equals(value, 212));
+    ctx.CHECK(reader.next_reply(status, value) && (status == REPLY_UNKNOWN));
+    ctx.CHECK(reader.next_reply(status, value) && (status == REPLY_UNKNOWN));
+    ctx.CHECK(!reader.next_reply(status, value));
+
+    ctx.result();
+
+    ctx.DESC("Truncated and impossible messages are caught");
+
+    // drop the last byte of the last request, keeping the promised count
+    string cut = message.substr(0, message.size() - 1);
+    uint32_t body = cut.size() - MESSAGE_HEADER;
+    memcpy(&cut[0], &body, sizeof(body));
+    replies.clear();
+    ctx.CHECK(serve_message(converter, cut.data(), cut.size(), replies));
+    MessageReader partial(replies.finish().data(), replies.finish().size());
+    ctx.CHECK(partial.size() == 4);
+    for (int i = 0; i < 4; i++) {
+        partial.next_reply(status, value);
+    }
+    ctx.CHECK(status == REPLY_MALFORMED);
+
+    // a header promising more requests than the body could hold
+    string huge = message;
+    uint32_t count = 1000000;
+    memcpy(&huge[4], &count, sizeof(count));
+    replies.clear();
+    ctx.CHECK(!serve_message(converter, huge.data(), huge.size(), replies));
+    ctx.CHECK(replies.size() == 0);
+
+    ctx.result();
+
+    ctx.DESC("Names from clients are never interned");
+
+    size_t symbols = UnitSymbols::size();
+    requests.clear();
+    for (int i = 0; i < 100; i++) {
+        requests.add_request(1, "junk" + to_string(i) + "*zz", "ft");
+        requests.add_request(1, "kjunk" + to_string(i), "ft");
+    }
+    requests.add_request(1, "mi/ft", "ft/ft");
+    const string &junk = requests.finish();
+    replies.clear();
+    ctx.CHECK(serve_message(converter, junk.data(), junk.size(), replies));
+    MessageReader answers(replies.finish().data(), replies.finish().size());
+    bool unknown = true;
+    for (int i = 0; i < 200; i++) {
+        unknown = unknown && answers.next_reply(status, value) &&
+                  (status == REPLY_UNKNOWN);
+    }
+    ctx.CHECK(unknown);
+    ctx.CHECK(answers.next_reply(status, value) && (status == REPLY_OK) &&
+              (value == 5280));
+    ctx.CHECK(UnitSymbols::size() == symbols);
+
+    ctx.result();
+}
+
+
+/*!
+ * Test converting one value to every connected unit at once
+ */
+void test_convert_to_all(TestContext &ctx) {
+    UnitConverter u;
+    u.add_conversion("mi", 5280, "ft");
+    u.add_conversion("ft", 12, "in");
+    u.add_conversion("yd", 3, "ft");
+    u.add_conversion("lb", 16, "oz");
+
+    ctx.DESC("Every connected unit, with the values convert_to gives");
+
+    vector<UValue> all = u.convert_to_all({2, "yd"});
+    ctx.CHECK(all.size() == 4);
+    bool same = true;
+    set<string> units;
+    for (const UValue &v : all) {
+        units.insert(v.get_units());
+        UValue one = u.convert_to({2, "yd"}, v.get_units());
+        same = same && (one.get_value() == v.get_value());
+    }
+    ctx.CHECK(same);
+    ctx.CHECK(units == set<string>({"mi", "ft", "in", "yd"}));
+    ctx.CHECK(u.convert_to_all({1, "parsec"}).empty());
+
+    ctx.result();
+
+    ctx.DESC("Only the requested targets, in the order given");
+
+    vector<UValue> some = u.convert_to_all({1, "mi"},
+                                           {"in", "oz", "ft", "ft*ft/in"});
+    ctx.CHECK(some.size() == 3);
+    ctx.CHECK((some[0].get_units() == "in") && (some[0].get_value() == 63360));
+    ctx.CHECK((some[1].get_units() == "ft") && (some[1].get_value() == 5280));
+    ctx.CHECK(some[2].get_units() == "ft*ft/in");
+    ctx.CHECK(epsilon_equals(some[2].get_value(), 440));
+
+    ctx.result();
+}
+
+
+/*!
+ * Test plans resolved once and applied many times
+ */
+void test_conversion_plans(TestContext &ctx) {
+    UnitConverter u;
+    u.add_conversion("mi", 5280, "ft");
+    u.add_conversion("ft", 12, "in");
+    u.add_conversion("C", 1.8, "F", 32);
+
+    ctx.DESC("Plans convert scalars, arrays and UValues");
+
+    ConversionPlan miles = u.plan("mi", "in");
+    ctx.CHECK(miles(2) == 126720);
+    ctx.CHECK(miles.from_units() == UnitSymbols::intern("mi"));
+    ctx.CHECK(miles.to_units() == UnitSymbols::intern("in"));
+
+    UValue v = miles(UValue{0.5, "mi"});
+    ctx.CHECK((v.get_value() == 31680) && (v.get_units() == "in"));
+    try {
+        miles(UValue{1, "ft"});
+        ctx.CHECK(false);
+    }
+    catch (invalid_argument &e) {
+        ctx.CHECK(true);
+    }
+
+    ConversionPlan temps = u.plan("C", "F");
+    vector<double> values{-40, 0, 37, 100, 20, 25, 30, 35, 40};
+    vector<double> expect(values.size());
+    temps(values.data(), expect.data(), values.size());
+    temps(values);
+    ctx.CHECK(values == expect);
+    ctx.CHECK(epsilon_equals(values[3], 212));
+    ctx.CHECK(epsilon_equals(temps(-40), -40));
+
+    try {
+        u.plan("mi", "F");
+        ctx.CHECK(false);
+    }
+    catch (invalid_argument &e) {
+        ctx.CHECK(true);
+    }
+
+    ctx.result();
+
+    ctx.DESC("Plans go stale when the rules change");
+
+    ctx.CHECK(u.is_current(miles));
+    UnitConverter copy = u;
+    ctx.CHECK(copy.is_current(miles));
+    u.add_conversion("yd", 3, "ft");
+    ctx.CHECK(!u.is_current(miles));
+    ctx.CHECK(copy.is_current(miles));
+    ctx.CHECK(u.is_current(u.plan("mi", "in")));
+
+    // a reloaded converter never reuses an old version
+    UnitConverter reloaded;
+    reloaded.add_conversion("mi", 5280, "ft");
+    ctx.CHECK(!reloaded.is_current(miles));
+
+    ConcurrentConverter shared(u);
+    ConversionPlan yards = shared.plan("yd", "in");
+    ctx.CHECK(yards(1) == 36);
+    ctx.CHECK(shared.is_current(yards));
+    shared.replace(u);
+    ctx.CHECK(shared.is_current(yards));
+    shared.add_conversion("furlong", 660, "ft");
+    ctx.CHECK(!shared.is_current(yards));
+    ctx.CHECK(yards(1) == 36);
+
+    ctx.result();
+}
+
+
+/*!
+ * Test the 64-bit Rational and exact conversion factors
+ */
+void test_exact_conversions(TestContext &ctx) {
+    ctx.DESC("Rationals parse decimal text exactly");
+
+    Rational r;
+    ctx.CHECK(Rational::parse("0.01905", r) && (r == Rational(381, 20000)));
+    ctx.CHECK(Rational::parse("-2.5e3", r) && (r == Rational(-2500)));
+    ctx.CHECK(Rational::parse("1e-3", r) && (r == Rational(1, 1000)));
+    ctx.CHECK(Rational::parse("2/6", r) && (r.num() == 1) &&
+              (r.denom() == 3));
+    ctx.CHECK(!Rational::parse("abc", r));
+    ctx.CHECK(!Rational::parse("1.5x", r));
+    ctx.CHECK(!Rational::parse("1/0", r));
+    ctx.CHECK(!Rational::parse("0.1234567890123456789012345", r));
+    ctx.CHECK(Rational(1, 3).to_double() == 1.0 / 3);
+    // rounded once, where dividing in long double would round twice
+    ctx.CHECK(Rational(8323507665962325945, 4678081745870580593).to_double()
+              == 1.779256566713402);
+    ctx.CHECK(Rational(-989275418329966829, 437463240143082164).to_double()
+              == -2.2613909639731147);
+    ctx.CHECK((Rational(1, 6) + Rational(1, 3)) == Rational(1, 2));
+    ctx.CHECK((Rational(4, 9) / Rational(2, 3)) == Rational(2, 3));
+
+    try {
+        Rational big(INT64_MAX / 2);
+        big *= Rational(3);
+        ctx.CHECK(false);
+    }
+    catch (overflow_error &e) {
+        ctx.CHECK(true);
+    }
+
+    ctx.result();
+
+    ctx.DESC("Exact rules compose without drift");
+
+    UnitConverter exact, rounded;
+    for (int i = 0; i < 18; i++) {
+        string from = "u" + to_string(i), to = "u" + to_string(i + 1);
+        exact.add_conversion(from, Rational(3, 10), to);
+        rounded.add_conversion(from, 0.3, to);
+    }
+    ctx.CHECK(exact.convert_to({1, "u0"}, "u10").get_value() == 5.9049e-6);
+    ctx.CHECK(rounded.convert_to({1, "u0"}, "u10").get_value() != 5.9049e-6);
+    ctx.CHECK(exact.convert_to({1, "u0"}, "u18").get_value() ==
+              3.87420489e-10);
+    ctx.CHECK(exact.convert_to({1, "u5"}, "u12").get_value() == 2.187e-4);
+
+    // every path between two units gives the same factor
+    exact.add_conversion("u0", Rational(27, 1000), "u3");
+    ctx.CHECK(exact.convert_to({1, "u3"}, "u1").get_value() == 100.0 / 9);
+
+    // chains that outgrow 64 bits still convert, through doubles
+    for (int i = 18; i < 25; i++) {
+        exact.add_conversion("u" + to_string(i), Rational(3, 10),
+                             "u" + to_string(i + 1));
+    }
+    ctx.CHECK(epsilon_equals(exact.convert_to({1, "u0"}, "u25").get_value()
+                             / pow(0.3, 25), 1));
+
+    ctx.result();
+
+    ctx.DESC("Plain rules never undo exact ones");
+
+    // the exact units join a larger component through a plain rule, which
+    // must not change what they convert to, cached or not
+    UnitConverter mixed;
+    for (int i = 0; i < 10; i++) {
+        mixed.add_conversion("u" + to_string(i), Rational(3, 10),
+                             "u" + to_string(i + 1));
+    }
+    ctx.CHECK(mixed.convert_to({1, "u0"}, "u10").get_value() == 5.9049e-6);
+    for (int i = 0; i < 20; i++) {
+        mixed.add_conversion("v" + to_string(i), 0.3,
+                             "v" + to_string(i + 1));
+    }
+    mixed.add_conversion("u10", 0.5, "v0");
+    UnitConverter fresh{mixed};
+    ctx.CHECK(mixed.convert_to({1, "u0"}, "u10").get_value() == 5.9049e-6);
+    ctx.CHECK(fresh.convert_to({1, "u0"}, "u10").get_value() == 5.9049e-6);
+    ctx.CHECK(fresh.convert_to({1, "u3"}, "u7").get_value() == 0.0081);
+
+    // an exact rule closing a cycle makes pairs across it exact, and drops
+    // what was cached for them
+    UnitConverter cycle;
+    cycle.add_conversion("a", Rational(3, 10), "b");
+    cycle.add_conversion("c", Rational(3, 10), "d");
+    cycle.add_conversion("b", 0.7, "c");
+    double before = cycle.convert_to({1, "a"}, "d").get_value();
+    cycle.add_conversion("b", Rational(21, 100), "d");
+    UnitConverter again{cycle};
+    ctx.CHECK(epsilon_equals(before, 0.063));
+    ctx.CHECK(cycle.convert_to({1, "a"}, "d").get_value() == 0.063);
+    ctx.CHECK(again.convert_to({1, "a"}, "d").get_value() == 0.063);
+
+    ctx.result();
+
+    ctx.DESC("Exact offsets, and loading rules files exactly");
+
+    UnitConverter temps;
+    temps.add_conversion("C", Rational(9, 5), "F", Rational(32));
+    temps.add_conversion("K", Rational(1), "C", Rational(-27315, 100));
+    ctx.CHECK(temps.convert_to({100, "C"}, "F").get_value() == 212);
+    ctx.CHECK(epsilon_equals(temps.convert_to({212, "F"}, "C").get_value(),
+                             100));
+    ctx.CHECK(epsilon_equals(temps.convert_to({0, "K"}, "F").get_value(),
+                             -459.67));
+    try {
+        temps.add_conversion("X", Rational(0), "C");
+        ctx.CHECK(false);
+    }
+    catch (invalid_argument &e) {
+        ctx.CHECK(true);
+    }
+
+    LoadOptions options;
+    options.exact = true;
+    UnitConverter loaded = load_converter("rules.txt", options);
+    ctx.CHECK(loaded.convert_to({1, "E"}, "A").get_value() == 0.01905);
+    ctx.CHECK(loaded.convert_to({1, "A"}, "D").get_value() == 24.5);
+    ctx.CHECK(loaded.convert_to({1, "D"}, "E").get_value() == 1.5 / 0.7);
+
+    // fractions load in either mode, and stay exact in exact mode
+    {
+        ofstream ofs{"test-fractions.tmp"};
+        ofs << "third 1/3 whole\nsixth 1/2 third\n";
+    }
+    UnitConverter thirds = load_converter("test-fractions.tmp", options);
+    UnitConverter plain  = load_converter("test-fractions.tmp");
+    ctx.CHECK(thirds.convert_to({3, "third"}, "whole").get_value() == 1);
+    ctx.CHECK(plain.convert_to({3, "third"}, "whole").get_value() == 1);
+    ctx.CHECK(thirds.convert_to({1, "whole"}, "sixth").get_value() == 6);
+    remove("test-fractions.tmp");
+
+    ctx.result();
+}
+
+
+/*!
+ * Test checking the rules that close a cycle while loading
+ */
+void test_cycle_check(TestContext &ctx) {
+    LoadOptions options;
+    options.check_cycles = true;
+    vector<InconsistentRule> inconsistent;
+
+    ctx.DESC("Inconsistent cycles are reported with their line");
+
+    UnitConverter u;
+    load_rules(u, "rules.txt", options, &inconsistent);
+    ctx.CHECK(inconsistent.size() == 1);
+    ctx.CHECK(inconsistent[0].line == 5);
+    ctx.CHECK((inconsistent[0].from_units == "E") &&
+              (inconsistent[0].to_units == "A"));
+    ctx.CHECK(inconsistent[0].given.scale == 0.01905);
+    ctx.CHECK(epsilon_equals(inconsistent[0].implied.scale, 1 / 52.5));
+    ctx.CHECK(epsilon_equals(inconsistent[0].error * 1e4, 1.25));
+    ctx.CHECK(u.rule_count() == 7);
+
+    // a looser tolerance accepts the same cycle
+    inconsistent.clear();
+    options.tolerance = 1e-3;
+    load_converter("rules.txt", options, &inconsistent);
+    ctx.CHECK(inconsistent.empty());
+
+    ctx.result();
+
+    ctx.DESC("Inconsistent rules can be left out");
+
+    options.tolerance = 1e-9;
+    options.reject_inconsistent = true;
+    inconsistent.clear();
+    UnitConverter v = load_converter("rules.txt", options, &inconsistent);
+    ctx.CHECK(inconsistent.size() == 1);
+    ctx.CHECK(v.rule_count() == 6);
+    ctx.CHECK(epsilon_equals(v.convert_to({1, "A"}, "E").get_value(), 52.5));
+
+    write_rules("test-rules.tmp",
+                "C 1.8 F 32\nK 1 C -273.15\nK 1.8 F -459.67\n"
+                "R 1 F -459.67\nK 1.8 R\nC 2 R\n");
+    inconsistent.clear();
+    v = load_converter("test-rules.tmp", options, &inconsistent);
+    ctx.CHECK(inconsistent.size() == 1);
+    ctx.CHECK(inconsistent[0].line == 6);
+    ctx.CHECK(v.rule_count() == 5);
+
+    // duplicates are still errors, not inconsistencies
+    write_rules("test-rules.tmp", "A 2 B\nB 0.5 A\n");
+    try {
+        load_converter("test-rules.tmp", options, &inconsistent);
+        ctx.CHECK(false);
+    }
+    catch (invalid_argument &e) {
+        ctx.CHECK(string(e.what()).find(":2:") != string::npos);
+    }
+    remove("test-rules.tmp");
+
+    ctx.result();
+}
+
+
+/*!
+ * Test the frozen compressed sparse row graph against its converter
+ */
+void test_frozen_graph(TestContext &ctx) {
+    UnitConverter u;
+    load_rules(u, "rules.txt");
+    u.add_conversion("C", 1.8, "F", 32);
+    u.add_conversion("K", 1, "C", -273.15);
+    u.add_conversion("lb", 16, "oz");
+    FrozenGraph g = u.freeze();
+
+    ctx.DESC("Every pair converts the same as in the converter");
+
+    vector<unit_id> units = u.known_units();
+    ctx.CHECK(g.unit_count() == units.size());
+    ctx.CHECK(g.rule_count() == u.rule_count());
+    ctx.CHECK(g.version() == u.version());
+    bool same = true;
+    for (unit_id from : units) {
+        for (unit_id to : units) {
+            Affine a, b;
+            bool ok = u.find_conversion(from, to, a);
+            same = same && (g.find_conversion(from, to, b) == ok) &&
+                   (g.can_convert(from, to) == ok) &&
+                   (!ok || ((a.scale == b.scale) && (a.offset == b.offset)));
+        }
+    }
+    ctx.CHECK(same);
+    ctx.CHECK(epsilon_equals(
+        g.convert_to({300, "K"}, UnitSymbols::intern("F")).get_value(), 80.33));
+
+    ctx.result();
+
+    ctx.DESC("Unknown and unconnected units");
+
+    unit_id parsec = UnitSymbols::intern("parsec");
+    Affine conversion;
+    ctx.CHECK(!g.known(parsec));
+    ctx.CHECK(!g.find_conversion(parsec, UnitSymbols::intern("F"), conversion));
+    ctx.CHECK(!g.can_convert(UnitSymbols::intern("lb"),
+                             UnitSymbols::intern("F")));
+    try {
+        g.convert_to({1, "lb"}, UnitSymbols::intern("C"));
+        ctx.CHECK(false);
+    }
+    catch (invalid_argument &e) {
+        ctx.CHECK(true);
+    }
+
+    ctx.result();
+
+    ctx.DESC("Paths have the fewest steps");
+
+    vector<unit_id> path = g.conversion_path(UnitSymbols::intern("K"),
+                                             UnitSymbols::intern("F"));
+    ctx.CHECK(path.size() == 3);
+    ctx.CHECK((path.front() == UnitSymbols::intern("K")) &&
+              (path.back() == UnitSymbols::intern("F")));
+    ctx.CHECK(g.conversion_path(UnitSymbols::intern("A"),
+                                UnitSymbols::intern("E")).size() ==
+              u.conversion_path("A", "E").size());
+    ctx.CHECK(g.conversion_path(parsec, UnitSymbols::intern("F")).empty());
+
+    ctx.result();
+
+    ctx.DESC("The frozen graph is smaller");
+
+    GraphMemory before = u.memory_usage(), after = g.memory_usage();
+    ctx.CHECK(before.edges == after.edges);
+    ctx.CHECK(after.edge_bytes < before.edge_bytes);
+    ctx.CHECK(after.total() < before.total());
+
+    ctx.result();
+}
+
+
+/*!
+ * Test SI prefixes resolved without rules of their own
+ */
+void test_si_prefixes(TestContext &ctx) {
+    UnitConverter u;
+    u.add_conversion("in", 0.0254, "m");
+    u.add_conversion("h", 3600, "s");
+    u.add_conversion("min", 60, "s");
+    u.add_conversion("g", 0.001, "kg");
+    u.add_conversion("C", 1.8, "F", 32);
+
+    ctx.DESC("Prefixed units convert through their base unit");
+
+    ctx.CHECK(epsilon_equals(u.convert_to({2, "km"}, "m").get_value(), 2000));
+    ctx.CHECK(epsilon_equals(u.convert_to({25.4, "mm"}, "in").get_value(), 1));
+    ctx.CHECK(epsilon_equals(u.convert_to({36, "km/h"}, "m/s").get_value(),
+                             10));
+    ctx.CHECK(epsilon_equals(u.convert_to({1, "km^2"}, "m^2").get_value(),
+                             1e6));
+    ctx.CHECK(epsilon_equals(u.convert_to({3, "dam"}, "m").get_value(), 30));
+    ctx.CHECK(epsilon_equals(u.convert_to({1, "\u00b5m"}, "um").get_value(),
+                             1));
+    ctx.CHECK(epsilon_equals(u.convert_to({5, "Mg"}, "kg").get_value(), 5000));
+    ctx.CHECK(u.rule_count() == 5);
+
+    // the search and whole-component entry points take prefixes too
+    ctx.CHECK(epsilon_equals(
+        u.convert_to({1, "km"}, "in", set<string>{}).get_value(), 1e5 / 2.54));
+    ctx.CHECK(epsilon_equals(
+        u.convert_to({2, "in"}, "mm", set<string>{}).get_value(), 50.8));
+    ctx.CHECK((u.conversion_path("km", "in") ==
+               vector<string>{"km", "m", "in"}));
+    ctx.CHECK((u.conversion_path("km", "mm") ==
+               vector<string>{"km", "m", "mm"}));
+    vector<UValue> all = u.convert_to_all({1, "km"});
+    ctx.CHECK(all.size() == 2);
+    for (const UValue &v : all) {
+        double expect = (v.get_units() == "m") ? 1000 : 1e5 / 2.54;
+        ctx.CHECK(epsilon_equals(v.get_value(), expect));
+    }
+
+    ctx.result();
+
+    ctx.DESC("Names in the rules are taken as written");
+
+    ctx.CHECK(u.convert_to({2, "min"}, "s").get_value() == 120);
+    ctx.CHECK(u.convert_to({1, "h"}, "s").get_value() == 3600);
+    ctx.CHECK(u.convert_to({1, "kg"}, "g").get_value() == 1000);
+
+    ctx.result();
+
+    ctx.DESC("Names that only look prefixed");
+
+    ctx.CHECK(!u.can_convert("kparsec", "m"));
+    ctx.CHECK(!u.can_convert("k", "m"));
+    ctx.CHECK(!u.can_convert("kkm", "m"));
+    ctx.CHECK(!u.can_convert("mC", "F"));
+    ctx.CHECK(!u.try_convert({1, "km"}, "s"));
+
+    ctx.result();
+
+    ctx.DESC("Prefixes through the concurrent converter");
+
+    ConcurrentConverter c(u);
+    ctx.CHECK(epsilon_equals(c.convert_to({3, "m"}, "nm").get_value(), 3e9));
+    ctx.CHECK(epsilon_equals(c.convert_to({7.2, "ks"}, "h").get_value(), 2));
+    ctx.CHECK(c.can_convert("mm/ms", "m/s"));
+
+    ctx.result();
+}
+
+
+/*!
+ * Test arithmetic on UValues through a bound converter
+ */
+void test_uvalue_arithmetic(TestContext &ctx) {
+    UnitConverter u;
+    u.add_conversion("ft", 12, "in");
+    u.add_conversion("yd", 3, "ft");
+    u.add_conversion("C", 1.8, "F", 32);
+
+    ctx.DESC("Same units need no converter, mixed units need one");
+
+    UValue sum = UValue{3, "ft"} + UValue{2, "ft"};
+    ctx.CHECK((sum.get_value() == 5) && (sum.get_units() == "ft"));
+    ctx.CHECK((UValue{1, "ft"} < UValue{2, "ft"}));
+    try {
+        sum = UValue{3, "ft"} + UValue{24, "in"};
+        ctx.CHECK(false);
+    }
+    catch (invalid_argument &e) {
+        ctx.CHECK(true);
+    }
+
+    ctx.result();
+
+    ctx.DESC("Sums and comparisons convert to the left-hand units");
+
+    {
+        BoundConverter bound(u);
+        sum = UValue{3, "ft"} + UValue{24, "in"};
+        ctx.CHECK((sum.get_value() == 5) && (sum.get_units() == "ft"));
+        UValue difference = UValue{1, "yd"} - UValue{1, "ft"};
+        ctx.CHECK(epsilon_equals(difference.get_value(), 2.0 / 3));
+        ctx.CHECK(difference.get_units() == "yd");
+        sum += UValue{1, "yd"};
+        ctx.CHECK(sum.get_value() == 8);
+
+        ctx.CHECK((UValue{1, "ft"} == UValue{12, "in"}));
+        ctx.CHECK((UValue{1, "ft"} != UValue{13, "in"}));
+        ctx.CHECK((UValue{1, "yd"} > UValue{35, "in"}));
+        ctx.CHECK((UValue{1, "ft"} < UValue{13, "in"}));
+        ctx.CHECK((UValue{1, "ft"} <= UValue{12, "in"}));
+        ctx.CHECK((UValue{100, "C"} >= UValue{212, "F"}));
+
+        // nan is unordered, so every ordering is false
+        UValue nan_ft{nan(""), "ft"};
+        UValue foot{12, "in"};
+        ctx.CHECK(!(nan_ft <= foot) && !(nan_ft >= foot));
+        ctx.CHECK(!(foot <= nan_ft) && !(foot >= nan_ft));
+        ctx.CHECK(epsilon_equals(
+            (UValue{1, "ft*ft"} + UValue{144, "in*in"}).get_value(), 2));
+
+        try {
+            UValue{1, "ft"} + UValue{1, "C"};
+            ctx.CHECK(false);
+        }
+        catch (invalid_argument &e) {
+            ctx.CHECK(true);
+        }
+    }
+
+    ctx.result();
+
+    ctx.DESC("Scaling by plain numbers");
+
+    UValue twice = 2 * UValue{3, "ft"};
+    ctx.CHECK((twice.get_value() == 6) && (twice.get_units() == "ft"));
+    ctx.CHECK((UValue{3, "ft"} * 2).get_value() == 6);
+    ctx.CHECK((UValue{3, "ft"} / 2).get_value() == 1.5);
+    ctx.CHECK((-UValue{3, "ft"}).get_value() == -3);
+
+    ctx.result();
+
+    ctx.DESC("Bindings nest, and notice changed rules");
+
+    UnitConverter metric;
+    metric.add_conversion("m", 100, "cm");
+    {
+        BoundConverter outer(u);
+        ctx.CHECK((UValue{1, "ft"} + UValue{12, "in"}).get_value() == 2);
+        {
+            BoundConverter inner(metric);
+            ctx.CHECK((UValue{1, "m"} + UValue{50, "cm"}).get_value() == 1.5);
+            ctx.CHECK(!u.can_convert("m", "cm"));
+        }
+        ctx.CHECK((UValue{1, "ft"} + UValue{12, "in"}).get_value() == 2);
+
+        // the same converter with other rules makes the cached plan stale
+        UnitConverter other;
+        other.add_conversion("ft", 10, "in");
+        u = other;
+        ctx.CHECK((UValue{1, "ft"} + UValue{10, "in"}).get_value() == 2);
+
+        // bindings belong to the thread that made them
+        bool threw = false;
+        thread t([&]() {
+            try {
+                UValue{1, "ft"} + UValue{10, "in"};
+            }
+            catch (invalid_argument &e) {
+                threw = true;
+            }
+        });
+        t.join();
+        ctx.CHECK(threw);
+    }
+
+    ctx.result();
 }
 
 
@@ -154,6 +1657,26 @@ int main() {
 
     test_converter(ctx);
     test_multistep_conversions(ctx);
+    test_component_conversions(ctx);
+    test_conversion_cache(ctx);
+    test_interned_units(ctx);
+    test_batch_conversion(ctx);
+    test_rules_loader(ctx);
+    test_snapshots(ctx);
+    test_static_converter(ctx);
+    test_quantities(ctx);
+    test_compound_units(ctx);
+    test_affine_conversions(ctx);
+    test_concurrent_converter(ctx);
+    test_rules_reload(ctx);
+    test_daemon_protocol(ctx);
+    test_convert_to_all(ctx);
+    test_conversion_plans(ctx);
+    test_exact_conversions(ctx);
+    test_cycle_check(ctx);
+    test_frozen_graph(ctx);
+    test_si_prefixes(ctx);
+    test_uvalue_arithmetic(ctx);
 
     // Return 0 if everything passed, nonzero if something failed.
     return !ctx.ok();
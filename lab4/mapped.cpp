@@ -0,0 +1,50 @@
+#include "mapped.h"
+#include <string>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/** maps the whole file read-only. the descriptor isn't needed afterwards */
+MappedFile::MappedFile(const string &filename) : bytes(nullptr), length(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw invalid_argument("Couldn't open " + filename);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw invalid_argument("Couldn't stat " + filename);
+    }
+    length = st.st_size;
+
+    // mmap refuses zero-length mappings, an empty file is just empty
+    if (length != 0) {
+        void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw invalid_argument("Couldn't map " + filename);
+        }
+        bytes = static_cast<const char *>(p);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (bytes != nullptr) {
+        munmap(const_cast<char *>(bytes), length);
+    }
+}
+
+const char *MappedFile::data() const {
+    return bytes;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
@@ -0,0 +1,44 @@
+#ifndef MAPPED_HH
+#define MAPPED_HH
+
+#include <cstddef>
+#include <string>
+using namespace std;
+
+/**
+ * a read-only memory mapping of a whole file, unmapped on destruction.
+ * throws invalid_argument if the file can't be opened or mapped.
+ */
+class MappedFile {
+    /** start of the mapping, or nullptr for an empty file */
+    const char *bytes;
+    /** length of the file */
+    size_t length;
+
+public:
+    /** constructor - maps the named file */
+    MappedFile(const string &filename);
+
+    /** destructor - unmaps the file */
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /** accessors */
+    /**
+     * gets the contents of the file
+     * @param void
+     * @return pointer to the first byte of the file
+     */
+    const char *data() const;
+
+    /**
+     * gets the length of the file
+     * @param void
+     * @return number of bytes in the file
+     */
+    size_t size() const;
+};
+
+#endif // MAPPED_HH
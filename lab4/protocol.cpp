@@ -0,0 +1,144 @@
+#include "protocol.h"
+#include <cstring>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+/** appends the raw bytes of a value */
+template <typename T>
+static void put(string &bytes, T value) {
+    bytes.append((const char *) &value, sizeof(value));
+}
+
+/** reads the raw bytes of a value, if there are enough left */
+template <typename T>
+static bool get(const char *&next, const char *end, T &value) {
+    if ((size_t) (end - next) < sizeof(value)) {
+        return false;
+    }
+    memcpy(&value, next, sizeof(value));
+    next += sizeof(value);
+    return true;
+}
+
+/** the header is reserved up front and filled in by finish */
+MessageWriter::MessageWriter() : bytes(MESSAGE_HEADER, '\0'), count(0) {
+}
+
+void MessageWriter::add_request
+(   double value, string_view from_units, string_view to_units   )
+{
+    put(bytes, value);
+    put(bytes, (uint16_t) from_units.size());
+    put(bytes, (uint16_t) to_units.size());
+    bytes.append(from_units.data(), from_units.size());
+    bytes.append(to_units.data(), to_units.size());
+    count++;
+}
+
+void MessageWriter::add_reply(ReplyStatus status, double value) {
+    put(bytes, (uint8_t) status);
+    put(bytes, value);
+    count++;
+}
+
+uint32_t MessageWriter::size() const {
+    return count;
+}
+
+/** the body length excludes the header itself */
+const string &MessageWriter::finish() {
+    uint32_t body = bytes.size() - MESSAGE_HEADER;
+    memcpy(&bytes[0], &body, sizeof(body));
+    memcpy(&bytes[4], &count, sizeof(count));
+    return bytes;
+}
+
+void MessageWriter::clear() {
+    bytes.resize(MESSAGE_HEADER);
+    count = 0;
+}
+
+/** reads the count, and bounds the body by the given length */
+MessageReader::MessageReader(const char *message, size_t length)
+    : next(message + MESSAGE_HEADER), end(message + length), count(0) {
+    memcpy(&count, message + 4, sizeof(count));
+}
+
+uint32_t MessageReader::size() const {
+    return count;
+}
+
+bool MessageReader::next_request
+(   double &value, string_view &from_units, string_view &to_units   )
+{
+    uint16_t from_length, to_length;
+    if (!get(next, end, value) || !get(next, end, from_length) ||
+        !get(next, end, to_length) ||
+        ((size_t) (end - next) < (size_t) from_length + to_length)) {
+        next = end;
+        return false;
+    }
+    from_units = string_view(next, from_length);
+    to_units   = string_view(next + from_length, to_length);
+    next += from_length + to_length;
+    return true;
+}
+
+bool MessageReader::next_reply(ReplyStatus &status, double &value) {
+    uint8_t code;
+    if (!get(next, end, code) || !get(next, end, value)) {
+        next = end;
+        return false;
+    }
+    status = (ReplyStatus) code;
+    return true;
+}
+
+/** the length field counts only the body */
+bool message_length(const char *data, size_t available, size_t &length) {
+    uint32_t body;
+    if (available < MESSAGE_HEADER) {
+        return false;
+    }
+    memcpy(&body, data, sizeof(body));
+    length = MESSAGE_HEADER + body;
+    return true;
+}
+
+/** names are copied into reused strings for the lookup, so a warmed-up
+ *  server allocates nothing per request */
+bool serve_message
+(   const ConcurrentConverter &converter, const char *message, size_t length,
+    MessageWriter &replies
+)
+{
+    MessageReader requests(message, length);
+    if ((size_t) requests.size() * MIN_REQUEST > length - MESSAGE_HEADER) {
+        return false;
+    }
+
+    thread_local string from_name, to_name;
+    for (uint32_t i = 0; i < requests.size(); i++) {
+        double value;
+        string_view from_units, to_units;
+        if (!requests.next_request(value, from_units, to_units)) {
+            replies.add_reply(REPLY_MALFORMED, 0);
+            continue;
+        }
+
+        from_name.assign(from_units.data(), from_units.size());
+        to_name.assign(to_units.data(), to_units.size());
+        // names from clients are never interned, or any client could grow
+        // the symbol table, and every converter sized by it, without limit
+        Affine conversion;
+        if (converter.find_conversion(from_name, to_name, conversion)) {
+            replies.add_reply(REPLY_OK, conversion.apply(value));
+        }
+        else {
+            replies.add_reply(REPLY_UNKNOWN, 0);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,146 @@
+#ifndef PROTOCOL_HH
+#define PROTOCOL_HH
+
+#include "concurrent.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+using namespace std;
+
+/*
+ * wire format of convertd. both ends run on the same machine, so integers
+ * and doubles are sent in native byte order with no padding.
+ *
+ *   message  = u32 body_length, u32 count, body
+ *   request  = f64 value, u16 from_length, u16 to_length, from, to
+ *   reply    = u8 status, f64 value
+ *
+ * a request message holds 'count' requests, and is answered by one reply
+ * message holding 'count' replies in the same order.
+ */
+
+/** bytes before the body of every message */
+const size_t MESSAGE_HEADER = 8;
+/** bytes of a request with empty unit names */
+const size_t MIN_REQUEST = 12;
+/** largest body a server will accept */
+const size_t MAX_MESSAGE = 1 << 20;
+
+/** outcome of one request */
+enum ReplyStatus : uint8_t {
+    /** converted, the value is the result */
+    REPLY_OK = 0,
+    /** the units are unknown or not connected by the rules */
+    REPLY_UNKNOWN = 1,
+    /** the request itself was cut short */
+    REPLY_MALFORMED = 2
+};
+
+/** builds one message of requests or replies */
+class MessageWriter {
+    /** the message so far, header included */
+    string bytes;
+    /** number of requests or replies added */
+    uint32_t count;
+
+public:
+    /** constructor - starts an empty message */
+    MessageWriter();
+
+    /**
+     * adds a request
+     * @param the value, and the units to convert from and to, each at most
+     *         65535 bytes long
+     * @return void
+     */
+    void add_request(double value, string_view from_units,
+                     string_view to_units);
+
+    /**
+     * adds a reply
+     * @param the status and the converted value
+     * @return void
+     */
+    void add_reply(ReplyStatus status, double value);
+
+    /**
+     * gets the number of requests or replies added so far
+     * @param void
+     * @return the count
+     */
+    uint32_t size() const;
+
+    /**
+     * fills in the header
+     * @param void
+     * @return the finished message, valid until the next change
+     */
+    const string &finish();
+
+    /**
+     * empties the message for reuse, keeping its memory
+     * @param void
+     * @return void
+     */
+    void clear();
+};
+
+/** walks the requests or replies of one received message */
+class MessageReader {
+    /** next unread byte of the body */
+    const char *next;
+    /** end of the body */
+    const char *end;
+    /** number of requests or replies the header promised */
+    uint32_t count;
+
+public:
+    /**
+     * constructor
+     * @param a whole message, header included, as sized by message_length
+     */
+    MessageReader(const char *message, size_t length);
+
+    /**
+     * gets the number of requests or replies the header promised
+     * @param void
+     * @return the count
+     */
+    uint32_t size() const;
+
+    /**
+     * reads the next request. the views point into the message
+     * @param where to store the value and the units
+     * @return false if the body ends before a whole request
+     */
+    bool next_request(double &value, string_view &from_units,
+                      string_view &to_units);
+
+    /**
+     * reads the next reply
+     * @param where to store the status and the value
+     * @return false if the body ends before a whole reply
+     */
+    bool next_reply(ReplyStatus &status, double &value);
+};
+
+/**
+ * checks whether a buffer starts with a whole message
+ * @param the buffered bytes, and where to store the message's total length
+ * @return true if the header has arrived. the message is complete once
+ *         'available' reaches 'length'
+ */
+bool message_length(const char *data, size_t available, size_t &length);
+
+/**
+ * answers every request of one message
+ * @param the converter, a whole request message, and where to add the
+ *         replies (one per request the header promised)
+ * @return false, with nothing added, if the header promises more requests
+ *         than the body could hold
+ */
+bool serve_message(const ConcurrentConverter &converter, const char *message,
+                   size_t length, MessageWriter &replies);
+
+#endif // PROTOCOL_HH
@@ -0,0 +1,223 @@
+#ifndef QUANTITY_HH
+#define QUANTITY_HH
+
+#include "units.h"
+#include <ratio>
+#include <string>
+using namespace std;
+
+/**
+ * a physical dimension as a list of exponents of the SI base dimensions:
+ * length, mass, time, current and temperature. velocity is Dim<1, 0, -1>.
+ */
+template <int L, int M, int T, int I = 0, int K = 0>
+struct Dim {
+    static constexpr int length      = L;
+    static constexpr int mass        = M;
+    static constexpr int time        = T;
+    static constexpr int current     = I;
+    static constexpr int temperature = K;
+};
+
+/** dimension of the product of two quantities */
+template <typename D1, typename D2>
+using DimMultiply = Dim<D1::length + D2::length, D1::mass + D2::mass,
+                        D1::time + D2::time, D1::current + D2::current,
+                        D1::temperature + D2::temperature>;
+
+/** dimension of the quotient of two quantities */
+template <typename D1, typename D2>
+using DimDivide = Dim<D1::length - D2::length, D1::mass - D2::mass,
+                      D1::time - D2::time, D1::current - D2::current,
+                      D1::temperature - D2::temperature>;
+
+/** the factor converting a value at scale 'From' to scale 'To' */
+template <typename From, typename To>
+constexpr double scale_factor() {
+    using r = ratio_divide<From, To>;
+    return double(r::num) / double(r::den);
+}
+
+/**
+ * a value with a dimension and a scale known at compile time. the scale is
+ * a std::ratio of the SI unit, so Quantity<Dim<1, 0, 0>, ratio<3048, 10000>>
+ * holds feet. mixing dimensions is a compile error, and changing scale is
+ * one multiply by a constant folded at compile time.
+ */
+template <typename D, typename Scale = ratio<1>>
+class Quantity {
+    /** the value, in units of Scale */
+    double count;
+
+public:
+    using dimension = D;
+    using scale     = Scale;
+
+    /** constructor */
+    constexpr explicit Quantity(double count = 0) : count(count) {
+    }
+
+    /** converts from the same dimension at any other scale */
+    template <typename S>
+    constexpr Quantity(const Quantity<D, S> &q)
+        : count(q.value() * scale_factor<S, Scale>()) {
+    }
+
+    /** accessors */
+    /**
+     * gets the value, in units of this quantity's scale
+     * @param void
+     * @return the value
+     */
+    constexpr double value() const {
+        return count;
+    }
+
+    /** arithmetic. the right-hand side is converted to this scale */
+    constexpr Quantity &operator+=(const Quantity &q) {
+        count += q.count;
+        return *this;
+    }
+
+    constexpr Quantity &operator-=(const Quantity &q) {
+        count -= q.count;
+        return *this;
+    }
+
+    constexpr Quantity &operator*=(double k) {
+        count *= k;
+        return *this;
+    }
+
+    constexpr Quantity &operator/=(double k) {
+        count /= k;
+        return *this;
+    }
+};
+
+/** converts a quantity to another scale of the same dimension */
+template <typename To, typename D, typename S>
+constexpr To quantity_cast(const Quantity<D, S> &q) {
+    static_assert(is_same<typename To::dimension, D>::value,
+                  "quantity_cast can't change the dimension");
+    return To{q};
+}
+
+/** sum and difference, in the scale of the left-hand side */
+template <typename D, typename S1, typename S2>
+constexpr Quantity<D, S1> operator+(Quantity<D, S1> a,
+                                    const Quantity<D, S2> &b) {
+    return a += Quantity<D, S1>{b};
+}
+
+template <typename D, typename S1, typename S2>
+constexpr Quantity<D, S1> operator-(Quantity<D, S1> a,
+                                    const Quantity<D, S2> &b) {
+    return a -= Quantity<D, S1>{b};
+}
+
+/** scaling by plain numbers */
+template <typename D, typename S>
+constexpr Quantity<D, S> operator*(Quantity<D, S> a, double k) {
+    return a *= k;
+}
+
+template <typename D, typename S>
+constexpr Quantity<D, S> operator*(double k, Quantity<D, S> a) {
+    return a *= k;
+}
+
+template <typename D, typename S>
+constexpr Quantity<D, S> operator/(Quantity<D, S> a, double k) {
+    return a /= k;
+}
+
+/** products and quotients combine dimensions and scales */
+template <typename D1, typename S1, typename D2, typename S2>
+constexpr Quantity<DimMultiply<D1, D2>, ratio_multiply<S1, S2>>
+operator*(const Quantity<D1, S1> &a, const Quantity<D2, S2> &b) {
+    return Quantity<DimMultiply<D1, D2>, ratio_multiply<S1, S2>>{
+        a.value() * b.value()};
+}
+
+template <typename D1, typename S1, typename D2, typename S2>
+constexpr Quantity<DimDivide<D1, D2>, ratio_divide<S1, S2>>
+operator/(const Quantity<D1, S1> &a, const Quantity<D2, S2> &b) {
+    return Quantity<DimDivide<D1, D2>, ratio_divide<S1, S2>>{
+        a.value() / b.value()};
+}
+
+/** comparisons, after converting the right-hand side */
+template <typename D, typename S1, typename S2>
+constexpr bool operator==(const Quantity<D, S1> &a, const Quantity<D, S2> &b) {
+    return a.value() == Quantity<D, S1>{b}.value();
+}
+
+template <typename D, typename S1, typename S2>
+constexpr bool operator!=(const Quantity<D, S1> &a, const Quantity<D, S2> &b) {
+    return !(a == b);
+}
+
+template <typename D, typename S1, typename S2>
+constexpr bool operator<(const Quantity<D, S1> &a, const Quantity<D, S2> &b) {
+    return a.value() < Quantity<D, S1>{b}.value();
+}
+
+template <typename D, typename S1, typename S2>
+constexpr bool operator>(const Quantity<D, S1> &a, const Quantity<D, S2> &b) {
+    return Quantity<D, S1>{b} < a;
+}
+
+template <typename D, typename S1, typename S2>
+constexpr bool operator<=(const Quantity<D, S1> &a, const Quantity<D, S2> &b) {
+    return a.value() <= Quantity<D, S1>{b}.value();
+}
+
+template <typename D, typename S1, typename S2>
+constexpr bool operator>=(const Quantity<D, S1> &a, const Quantity<D, S2> &b) {
+    return Quantity<D, S1>{b} <= a;
+}
+
+/** common dimensions */
+using Length   = Dim<1, 0, 0>;
+using Mass     = Dim<0, 1, 0>;
+using Time     = Dim<0, 0, 1>;
+using Velocity = Dim<1, 0, -1>;
+
+/** common units */
+using meters      = Quantity<Length>;
+using kilometers  = Quantity<Length, kilo>;
+using centimeters = Quantity<Length, centi>;
+using inches      = Quantity<Length, ratio<254, 10000>>;
+using feet        = Quantity<Length, ratio<3048, 10000>>;
+using miles       = Quantity<Length, ratio<1609344, 1000>>;
+using kilograms   = Quantity<Mass>;
+using grams       = Quantity<Mass, milli>;
+using pounds      = Quantity<Mass, ratio<45359237, 100000000>>;
+using seconds     = Quantity<Time>;
+using minutes     = Quantity<Time, ratio<60>>;
+using hours       = Quantity<Time, ratio<3600>>;
+
+/**
+ * bridge to the runtime converter: wraps a quantity as a UValue
+ * @param the quantity, and the runtime name of its units
+ * @return the UValue holding the same value
+ */
+template <typename D, typename S>
+UValue to_uvalue(const Quantity<D, S> &q, const string &units) {
+    return UValue{q.value(), units};
+}
+
+/**
+ * bridge from the runtime converter: converts a UValue to the runtime units
+ * matching a quantity type, then wraps the value
+ * throws invalid_argument if the converter can't make the conversion
+ * @param the UValue, the converter, and the runtime name of Q's units
+ * @return the quantity
+ */
+template <typename Q>
+Q from_uvalue(const UValue &v, UnitConverter &u, const string &units) {
+    return Q{u.convert_to(v, units).get_value()};
+}
+
+#endif // QUANTITY_HH
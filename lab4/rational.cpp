@@ -0,0 +1,288 @@
+#include "rational.h"
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace {
+
+/** the widest intermediate: any product or cross sum of two 64-bit parts */
+using wide = __int128;
+
+/** number of significant bits of a non-negative number */
+int bit_length(wide v) {
+    int bits = 0;
+    for (; v != 0; v >>= 1) {
+        bits++;
+    }
+    return bits;
+}
+
+/** greatest common divisor of two non-negative numbers */
+wide gcd(wide a, wide b) {
+    while (b != 0) {
+        wide r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+/** narrows a reduced part back to 64 bits. INT64_MIN is refused too, so
+ *  negation never overflows */
+int64_t narrow(wide v) {
+    if ((v > INT64_MAX) || (v < -INT64_MAX)) {
+        throw overflow_error("rational number out of 64-bit range");
+    }
+    return (int64_t) v;
+}
+
+/** reduces n/d with d > 0 and stores it narrowed */
+void store(wide n, wide d, int64_t &num, int64_t &denom) {
+    wide div = gcd(n < 0 ? -n : n, d);
+    if (div > 1) {
+        n /= div;
+        d /= div;
+    }
+    num   = narrow(n);
+    denom = narrow(d);
+}
+
+/** 10^k for k up to 38, which is as far as 128 bits go */
+bool power_of_ten(int k, wide &result) {
+    if ((k < 0) || (k > 38)) {
+        return false;
+    }
+    result = 1;
+    for (int i = 0; i < k; i++) {
+        result *= 10;
+    }
+    return true;
+}
+
+/** parses an optionally signed decimal with optional fraction and
+ *  exponent, such as -12.5e-3 */
+bool parse_decimal(string_view text, wide &n, wide &d) {
+    size_t i = 0;
+    bool negative = false;
+    if ((i < text.size()) && ((text[i] == '-') || (text[i] == '+'))) {
+        negative = (text[i] == '-');
+        i++;
+    }
+
+    // mantissa digits, counting those after the point
+    n = 0;
+    int digits = 0, fraction = 0;
+    bool point = false;
+    for (; i < text.size(); i++) {
+        char c = text[i];
+        if ((c == '.') && !point) {
+            point = true;
+        }
+        else if ((c >= '0') && (c <= '9')) {
+            if (++digits > 36) {
+                return false;
+            }
+            n = n * 10 + (c - '0');
+            fraction += point;
+        }
+        else {
+            break;
+        }
+    }
+    if (digits == 0) {
+        return false;
+    }
+
+    int exponent = 0;
+    if ((i < text.size()) && ((text[i] == 'e') || (text[i] == 'E'))) {
+        i++;
+        bool negative_exponent = false;
+        if ((i < text.size()) && ((text[i] == '-') || (text[i] == '+'))) {
+            negative_exponent = (text[i] == '-');
+            i++;
+        }
+        size_t start = i;
+        for (; (i < text.size()) && (text[i] >= '0') && (text[i] <= '9');
+             i++) {
+            exponent = exponent * 10 + (text[i] - '0');
+            if (exponent > 100) {
+                return false;
+            }
+        }
+        if (i == start) {
+            return false;
+        }
+        exponent = negative_exponent ? -exponent : exponent;
+    }
+    if (i != text.size()) {
+        return false;
+    }
+
+    // value = n * 10^(exponent - fraction)
+    wide scale;
+    int shift = exponent - fraction;
+    if (!power_of_ten(shift < 0 ? -shift : shift, scale)) {
+        return false;
+    }
+    d = 1;
+    if (shift < 0) {
+        d = scale;
+    }
+    else if ((n != 0) && (scale > ((wide) 1 << 125) / n)) {
+        return false;
+    }
+    else {
+        n *= scale;
+    }
+    n = negative ? -n : n;
+    return true;
+}
+
+}
+
+Rational::Rational(int64_t n, int64_t d) {
+    if (d == 0) {
+        string error = "invalid: division by 0";
+        throw invalid_argument(error);
+    }
+    // If d is neg, invert the sign of both n and d so that d is pos
+    wide wn = n, wd = d;
+    if (wd < 0) {
+        wn = -wn;
+        wd = -wd;
+    }
+    store(wn, wd, this->n, this->d);
+}
+
+int64_t Rational::num() const {
+    return n;
+}
+
+int64_t Rational::denom() const {
+    return d;
+}
+
+Rational Rational::reciprocal() const {
+    return Rational{d, n};
+}
+
+/** divides in integers, scaled so the quotient has exactly 53 bits, and
+ *  rounds once to nearest even from the remainder. the quotient of two
+ *  64-bit parts is never subnormal, so scaling the result is exact */
+double Rational::to_double() const {
+    if (n == 0) {
+        return 0;
+    }
+    wide num = (n < 0) ? -(wide) n : n;
+    wide den = d;
+
+    // 2^shift * num / den lands in [2^52, 2^53), and the shifted part
+    // stays below 2^117
+    int shift = 53 - (bit_length(num) - bit_length(den));
+    wide top = (shift > 0) ? num << shift : num;
+    wide bot = (shift < 0) ? den << -shift : den;
+    if (top / bot >= ((wide) 1 << 53)) {
+        shift--;
+        if (shift >= 0) {
+            top >>= 1;
+        }
+        else {
+            bot <<= 1;
+        }
+    }
+
+    wide q = top / bot, r = top % bot;
+    if ((2 * r > bot) || ((2 * r == bot) && (q & 1))) {
+        q++;
+    }
+    double result = ldexp((double) q, -shift);
+    return (n < 0) ? -result : result;
+}
+
+/** a decimal, or two decimals separated by '/' */
+bool Rational::parse(string_view text, Rational &result) {
+    wide n, d, n2 = 1, d2 = 1;
+    size_t slash = text.find('/');
+    if (!parse_decimal(text.substr(0, slash), n, d) ||
+        ((slash != string_view::npos) &&
+         !parse_decimal(text.substr(slash + 1), n2, d2)) ||
+        (n2 == 0)) {
+        return false;
+    }
+
+    try {
+        // (n/d) / (n2/d2), each part reduced before the cross product
+        Rational a, b;
+        store(n, d, a.n, a.d);
+        store(n2 < 0 ? -d2 : d2, n2 < 0 ? -n2 : n2, b.n, b.d);
+        result = a * b;
+    }
+    catch (overflow_error &e) {
+        return false;
+    }
+    return true;
+}
+
+Rational &Rational::operator*=(const Rational &r) {
+    store((wide) n * r.n, (wide) d * r.d, n, d);
+    return *this;
+}
+
+Rational &Rational::operator/=(const Rational &r) {
+    *this *= r.reciprocal();
+    return *this;
+}
+
+Rational &Rational::operator+=(const Rational &r) {
+    store((wide) n * r.d + (wide) r.n * d, (wide) d * r.d, n, d);
+    return *this;
+}
+
+Rational &Rational::operator-=(const Rational &r) {
+    *this += -r;
+    return *this;
+}
+
+Rational Rational::operator-() const {
+    Rational neg;
+    neg.n = -n;
+    neg.d = d;
+    return neg;
+}
+
+bool Rational::operator==(const Rational &r) const {
+    return (n == r.n) && (d == r.d);
+}
+
+bool Rational::operator!=(const Rational &r) const {
+    return !(*this == r);
+}
+
+Rational operator*(const Rational &r1, const Rational &r2) {
+    return Rational{r1} *= r2;
+}
+
+Rational operator/(const Rational &r1, const Rational &r2) {
+    return Rational{r1} /= r2;
+}
+
+Rational operator+(const Rational &r1, const Rational &r2) {
+    return Rational{r1} += r2;
+}
+
+Rational operator-(const Rational &r1, const Rational &r2) {
+    return Rational{r1} -= r2;
+}
+
+ostream &operator<<(ostream &os, const Rational &r) {
+    os << r.num();
+
+    if (r.denom() != 1) {
+        os << "/" << r.denom();
+    }
+    return os;
+}
@@ -0,0 +1,147 @@
+#ifndef RATIONAL_HH
+#define RATIONAL_HH
+
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+using namespace std;
+
+/**
+ * a rational number with 64-bit numerator and denominator, always kept
+ * reduced with a positive denominator. products and sums are formed in
+ * 128 bits and reduced before narrowing, so they are exact whenever the
+ * reduced result fits; otherwise they throw overflow_error rather than wrap.
+ */
+class Rational {
+    /** numerator and denominator */
+    int64_t n, d;
+
+public:
+    /**
+     * Rational constructor
+     * throws invalid_argument if d is 0, and overflow_error if the reduced
+     * value doesn't fit
+     * @param numerator and denominator
+     * @return instance of Rational with given n/d, reduced
+     */
+    Rational(int64_t n = 0, int64_t d = 1);
+
+    /**
+     * accessor - returns numerator
+     * @param void
+     * @return numerator of Rational object
+     */
+    int64_t num() const;
+
+    /**
+     * accessor - returns denominator
+     * @param void
+     * @return denominator of Rational object, always positive
+     */
+    int64_t denom() const;
+
+    // methods
+    /**
+     * return reciprocal of rational fract (i.e. n/d -> d/n)
+     * throws invalid_argument if the number is 0
+     * @param void
+     * @return instance Rational object representing the reciprocal
+     */
+    Rational reciprocal() const;
+
+    /**
+     * converts to the nearest double
+     * @param void
+     * @return the value as a double
+     */
+    double to_double() const;
+
+    /**
+     * parses decimal text such as '0.01905', '-2.5e3' or '1/3' exactly
+     * @param the text, and where to store the number
+     * @return false if the text isn't a number, or has more digits than a
+     *         64-bit fraction can hold
+     */
+    static bool parse(string_view text, Rational &result);
+
+    /**
+     * compound assignment multiplication for the Rational class
+     * @param Rational object
+     * @return Rational object
+     */
+    Rational &operator*=(const Rational &r);
+
+    /**
+     * compound assignment division for the Rational class
+     * @param Rational object
+     * @return Rational object
+     */
+    Rational &operator/=(const Rational &r);
+
+    /**
+     * compound assignment addition for the Rational class
+     * @param Rational object
+     * @return Rational object
+     */
+    Rational &operator+=(const Rational &r);
+
+    /**
+     * compound assignment subtraction for the Rational class
+     * @param Rational object
+     * @return Rational object
+     */
+    Rational &operator-=(const Rational &r);
+
+    /**
+     * negation
+     * @param void
+     * @return the Rational with the opposite sign
+     */
+    Rational operator-() const;
+
+    /**
+     * equality. reduced fractions are equal iff their parts are
+     * @param Rational object
+     * @return true if the numbers are equal
+     */
+    bool operator==(const Rational &r) const;
+
+    bool operator!=(const Rational &r) const;
+};
+
+/**
+ * simple arithmetic multiplication for the Rational class
+ * @param two Rational objects
+ * @return Rational object
+ */
+Rational operator*(const Rational &r1, const Rational &r2);
+
+/**
+ * simple arithmetic division for the Rational class
+ * @param two Rational objects
+ * @return Rational object
+ */
+Rational operator/(const Rational &r1, const Rational &r2);
+
+/**
+ * simple arithmetic addition for the Rational class
+ * @param two Rational objects
+ * @return Rational object
+ */
+Rational operator+(const Rational &r1, const Rational &r2);
+
+/**
+ * simple arithmetic subtraction for the Rational class
+ * @param two Rational objects
+ * @return Rational object
+ */
+Rational operator-(const Rational &r1, const Rational &r2);
+
+/**
+ * stream output of rational value
+ * @param ostream and Rational object
+ * @return ostream
+ */
+ostream &operator<<(ostream &os, const Rational &r);
+
+#endif // RATIONAL_HH
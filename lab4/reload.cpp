@@ -0,0 +1,121 @@
+#include "reload.h"
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace std;
+
+/** watches the directory rather than the file, since editors and deploy
+ *  scripts often replace the file with a rename, which a watch on the old
+ *  inode would never see */
+RulesWatcher::RulesWatcher
+(   ConcurrentConverter &target, const string &filename,
+    function<void(const ReloadReport &)> report, const LoadOptions &options
+)
+    : target(target), filename(filename), options(options),
+      report(move(report))
+{
+    size_t slash = filename.rfind('/');
+    string dir = (slash == string::npos) ? "." : filename.substr(0, slash + 1);
+
+    notify_fd = inotify_init1(IN_CLOEXEC);
+    if (notify_fd < 0) {
+        throw invalid_argument("Couldn't watch " + filename + ": " +
+                               strerror(errno));
+    }
+    if ((inotify_add_watch(notify_fd, dir.c_str(),
+                           IN_CLOSE_WRITE | IN_MOVED_TO) < 0) ||
+        (pipe(stop_fds) != 0)) {
+        int error = errno;
+        close(notify_fd);
+        throw invalid_argument("Couldn't watch " + filename + ": " +
+                               strerror(error));
+    }
+    watcher = thread(&RulesWatcher::watch, this);
+}
+
+/** wakes the thread through the pipe and waits for it */
+RulesWatcher::~RulesWatcher() {
+    char stop = 0;
+    while ((write(stop_fds[1], &stop, 1) < 0) && (errno == EINTR)) {
+    }
+    watcher.join();
+    close(stop_fds[0]);
+    close(stop_fds[1]);
+    close(notify_fd);
+}
+
+/** one reload per batch of events, however many touched the file */
+void RulesWatcher::watch() {
+    size_t slash = filename.rfind('/');
+    string base = (slash == string::npos) ? filename
+                                          : filename.substr(slash + 1);
+    alignas(inotify_event) char buffer[4096];
+
+    while (true) {
+        pollfd fds[2] = {{notify_fd, POLLIN, 0}, {stop_fds[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+
+        ssize_t length = read(notify_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            continue;
+        }
+        bool changed = false;
+        for (char *p = buffer; p < buffer + length; ) {
+            const inotify_event *event = (const inotify_event *) p;
+            if ((event->len != 0) && (base == event->name)) {
+                changed = true;
+            }
+            p += sizeof(inotify_event) + event->len;
+        }
+        if (changed) {
+            reload_now();
+        }
+    }
+}
+
+/** builds the new converter off to the side, so readers never wait on the
+ *  parsing, and only the final replace touches the shared one */
+ReloadReport RulesWatcher::reload_now() {
+    lock_guard<mutex> lock(reloading);
+    auto start = chrono::steady_clock::now();
+    ReloadReport result{false, 0, 0, 0, 0, ""};
+
+    try {
+        vector<InconsistentRule> inconsistent;
+        UnitConverter next = load_converter(filename, options, &inconsistent);
+        result.rules        = next.rule_count();
+        result.inconsistent = inconsistent.size();
+        // a file caught half-written is usually empty; never publish that
+        if (result.rules == 0) {
+            throw invalid_argument(filename + ": no rules");
+        }
+        target.replace(move(next));
+        result.ok = true;
+    }
+    catch (invalid_argument &e) {
+        result.rules = 0;
+        result.error = e.what();
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+    result.version = target.publish_count();
+    if (report) {
+        report(result);
+    }
+    return result;
+}
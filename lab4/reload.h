@@ -0,0 +1,91 @@
+#ifndef RELOAD_HH
+#define RELOAD_HH
+
+#include "concurrent.h"
+#include "rules.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+using namespace std;
+
+/** the outcome of one reload of the rules file */
+struct ReloadReport {
+    /** whether the new rules were published */
+    bool ok;
+    /** number of rules in the new version, or 0 if it failed */
+    size_t rules;
+    /** rules that failed the cycle check, if the options ask for it */
+    size_t inconsistent;
+    /** time spent loading, validating and publishing, in seconds */
+    double seconds;
+    /** versions the converter has published after the reload, as counted
+     *  by ConcurrentConverter::publish_count */
+    uint64_t version;
+    /** why the reload failed, empty if it succeeded */
+    string error;
+};
+
+/**
+ * keeps a ConcurrentConverter in step with its rules file. a background
+ * thread waits on inotify for the file to be written or replaced, loads it
+ * into a new converter, and publishes it only if it loaded cleanly. a file
+ * that fails to load leaves the current version in place. conversions
+ * already running finish on the version they started with.
+ * throws invalid_argument if the file's directory can't be watched.
+ */
+class RulesWatcher {
+    /** the converter reloads are published to */
+    ConcurrentConverter &target;
+    /** the watched rules file */
+    string filename;
+    /** how the file is loaded */
+    LoadOptions options;
+    /** called after every reload attempt */
+    function<void(const ReloadReport &)> report;
+
+    /** inotify descriptor watching the file's directory */
+    int notify_fd;
+    /** pipe written to wake the thread when stopping */
+    int stop_fds[2];
+    /** serializes reloads from the thread and from reload_now */
+    mutex reloading;
+    /** the background thread */
+    thread watcher;
+
+    /**
+     * waits for changes to the file until told to stop
+     * @param void
+     * @return void
+     */
+    void watch();
+
+public:
+    /**
+     * constructor - starts watching. the file is not loaded until it
+     * changes, since the target already holds its current rules
+     * @param the converter to publish to, the rules file (text or
+     *         snapshot), an optional callback for each reload, and how to
+     *         load the file
+     */
+    RulesWatcher(ConcurrentConverter &target, const string &filename,
+                 function<void(const ReloadReport &)> report = nullptr,
+                 const LoadOptions &options = LoadOptions());
+
+    /** destructor - stops the thread */
+    ~RulesWatcher();
+
+    RulesWatcher(const RulesWatcher &) = delete;
+    RulesWatcher &operator=(const RulesWatcher &) = delete;
+
+    /**
+     * loads the file and publishes it right away, as a change would
+     * @param void
+     * @return what happened, which is also passed to the callback
+     */
+    ReloadReport reload_now();
+};
+
+#endif // RELOAD_HH
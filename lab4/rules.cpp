@@ -0,0 +1,188 @@
+#include "rules.h"
+#include "mapped.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace {
+
+/** true for the blanks that separate the fields of a rule */
+bool is_blank(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+/** splits off the next field of a line, or returns an empty view */
+string_view next_field(const char *&p, const char *end) {
+    while ((p != end) && is_blank(*p)) {
+        p++;
+    }
+    const char *start = p;
+    while ((p != end) && !is_blank(*p)) {
+        p++;
+    }
+    return string_view(start, p - start);
+}
+
+/** parses a whole field as a finite number. nan and inf are not numbers
+ *  here */
+bool parse_decimal(string_view field, double &number) {
+    const char *end = field.data() + field.size();
+    auto parsed = from_chars(field.data(), end, number);
+    return (parsed.ec == errc{}) && (parsed.ptr == end) && isfinite(number);
+}
+
+/** parses a whole field as a number, or as one fraction a/b of two numbers
+ *  as Rational::parse accepts */
+bool parse_number(string_view field, double &number) {
+    size_t slash = field.find('/');
+    if (slash == string_view::npos) {
+        return parse_decimal(field, number);
+    }
+
+    double a, b;
+    if (!parse_decimal(field.substr(0, slash), a) ||
+        !parse_decimal(field.substr(slash + 1), b) || (b == 0)) {
+        return false;
+    }
+    number = a / b;
+    return isfinite(number);
+}
+
+/** how far a rule is from what the earlier rules imply, as documented on
+ *  InconsistentRule::error */
+double disagreement(const Affine &given, const Affine &implied) {
+    double scale  = fabs(given.scale - implied.scale) / fabs(implied.scale);
+    double offset = fabs(given.offset - implied.offset) /
+                    max(fabs(implied.offset), 1.0);
+    return max(scale, offset);
+}
+
+/** builds the error for a bad line of the rules file */
+invalid_argument rule_error(const string &filename, size_t line_no,
+                            const string &message) {
+    return invalid_argument(filename + ":" + to_string(line_no) + ": " +
+                            message);
+}
+
+}
+
+/** parses the mapped file line by line without copying it */
+size_t load_rules
+(   UnitConverter &converter, const string &filename,
+    const LoadOptions &options, vector<InconsistentRule> *inconsistent
+)
+{
+    MappedFile file{filename};
+    const char *p   = file.data();
+    const char *end = p + file.size();
+
+    // reused for every rule, so they only allocate for unusually long names
+    string from_units, to_units;
+    size_t line_no = 0, count = 0;
+
+    while (p < end) {
+        line_no++;
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (eol == nullptr) {
+            eol = end;
+        }
+
+        string_view from = next_field(p, eol);
+        if (!from.empty()) {
+            string_view mult = next_field(p, eol);
+            string_view to   = next_field(p, eol);
+            string_view off  = next_field(p, eol);
+            double multiplier, offset = 0;
+
+            if (to.empty() || !next_field(p, eol).empty()) {
+                throw rule_error(filename, line_no,
+                                 "expected 'from_units multiplier to_units "
+                                 "[offset]'");
+            }
+            if (!parse_number(mult, multiplier)) {
+                throw rule_error(filename, line_no, "bad multiplier '" +
+                                 string(mult) + "'");
+            }
+            if (!off.empty() && !parse_number(off, offset)) {
+                throw rule_error(filename, line_no, "bad offset '" +
+                                 string(off) + "'");
+            }
+            if (multiplier == 0) {
+                throw rule_error(filename, line_no, "multiplier is zero");
+            }
+
+            from_units.assign(from.data(), from.size());
+            to_units.assign(to.data(), to.size());
+            Rational exact_multiplier, exact_offset;
+            bool exact = options.exact &&
+                         Rational::parse(mult, exact_multiplier) &&
+                         (off.empty() || Rational::parse(off, exact_offset));
+            Affine given = exact ? ExactAffine{exact_multiplier,
+                                               exact_offset}.rounded()
+                                 : Affine{multiplier, offset};
+
+            // a new rule between units that already share a root closes a
+            // cycle, and the root already says what it should be.
+            // duplicates are left for add_conversion to reject
+            unit_id from_id, to_id, from_root, to_root;
+            Affine implied, unused;
+            if (options.check_cycles &&
+                UnitSymbols::find(from_units, from_id) &&
+                UnitSymbols::find(to_units, to_id) &&
+                converter.root_of(from_id, from_root, unused) &&
+                converter.root_of(to_id, to_root, unused) &&
+                (from_root == to_root) &&
+                !converter.has_rule(from_id, to_id) &&
+                converter.find_conversion(from_id, to_id, implied) &&
+                (disagreement(given, implied) > options.tolerance)) {
+                if (inconsistent != nullptr) {
+                    inconsistent->push_back(InconsistentRule{
+                        line_no, from_units, to_units, given, implied,
+                        disagreement(given, implied)});
+                }
+                if (options.reject_inconsistent) {
+                    p = eol + 1;
+                    continue;
+                }
+            }
+
+            try {
+                if (exact) {
+                    converter.add_conversion(from_units, exact_multiplier,
+                                             to_units, exact_offset);
+                }
+                else {
+                    converter.add_conversion(from_units, multiplier,
+                                             to_units, offset);
+                }
+            }
+            catch (invalid_argument &e) {
+                throw rule_error(filename, line_no, e.what());
+            }
+            count++;
+        }
+
+        p = eol + 1;
+    }
+    return count;
+}
+
+/** snapshots are recognized by their magic number */
+UnitConverter load_converter
+(   const string &filename, const LoadOptions &options,
+    vector<InconsistentRule> *inconsistent
+)
+{
+    if (UnitConverter::is_snapshot(filename)) {
+        return UnitConverter::load_snapshot(filename);
+    }
+    UnitConverter converter;
+    load_rules(converter, filename, options, inconsistent);
+    return converter;
+}
@@ -0,0 +1,72 @@
+#ifndef RULES_HH
+#define RULES_HH
+
+#include "units.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+using namespace std;
+
+/** how a rules file is loaded */
+struct LoadOptions {
+    /** parse multipliers and offsets as exact decimals, so conversions
+     *  compose exactly and round to double only at the end. numbers with
+     *  more digits than a 64-bit fraction holds are taken as doubles */
+    bool exact = false;
+    /** check each rule that closes a cycle against the conversion the
+     *  rules before it already give. the check is a constant-time lookup
+     *  through the two units' shared component root, so a whole file is
+     *  still loaded in near-linear time */
+    bool check_cycles = false;
+    /** largest relative disagreement allowed around a cycle */
+    double tolerance = 1e-9;
+    /** leave out rules that fail the check, rather than only reporting them */
+    bool reject_inconsistent = false;
+};
+
+/** a rule whose cycle disagrees with the rules loaded before it */
+struct InconsistentRule {
+    /** line of the rule in the rules file */
+    size_t line;
+    /** the units of the rule */
+    string from_units, to_units;
+    /** the conversion the rule gives */
+    Affine given;
+    /** the conversion the earlier rules already gave for the same pair */
+    Affine implied;
+    /** relative disagreement between the two: the multipliers relative to
+     *  each other, and the offsets relative to the larger of the implied
+     *  offset and one unit */
+    double error;
+};
+
+/**
+ * adds every rule of a rules file to a converter. each non-blank line has
+ * the form 'from_units multiplier to_units [offset]', meaning one from_units
+ * is multiplier * to_units + offset ('C 1.8 F 32'). numbers may also be
+ * written as fractions such as '1/3', which 'exact' keeps exact. the file is
+ * memory-mapped and parsed in place, so loading is linear in its size.
+ * throws invalid_argument if the file can't be read, or naming the line of
+ * the first malformed or duplicate rule.
+ * @param the converter to add to, the name of the rules file, how to load
+ *         it, and where to list rules that fail the cycle check, if wanted
+ * @return the number of rules added
+ */
+size_t load_rules(UnitConverter &converter, const string &filename,
+                  const LoadOptions &options = LoadOptions(),
+                  vector<InconsistentRule> *inconsistent = nullptr);
+
+/**
+ * builds a converter from a file that may be either a text rules file or a
+ * snapshot written by UnitConverter::save_snapshot. snapshots only hold
+ * doubles, so they load as if 'exact' were off
+ * throws invalid_argument if the file can't be loaded
+ * @param the name of the file, how to load it if it is a rules file, and
+ *         where to list rules that fail the cycle check, if wanted
+ * @return the loaded converter
+ */
+UnitConverter load_converter(const string &filename,
+                             const LoadOptions &options = LoadOptions(),
+                             vector<InconsistentRule> *inconsistent = nullptr);
+
+#endif // RULES_HH
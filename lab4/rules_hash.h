@@ -0,0 +1,24 @@
+#ifndef RULES_HASH_HH
+#define RULES_HASH_HH
+
+#include <cstdint>
+#include <string_view>
+using namespace std;
+
+/**
+ * seeded FNV-1a hash of a unit name. shared by genrules, which searches for
+ * seeds that make it collision-free, and by the generated tables, which
+ * evaluate it at compile time.
+ * @param the unit name, and the seed
+ * @return the hash
+ */
+constexpr uint32_t rules_hash(string_view units, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (char c : units) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+#endif // RULES_HASH_HH
@@ -0,0 +1,83 @@
+#include "scale.h"
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCALE_X86 1
+#endif
+
+using namespace std;
+
+namespace {
+
+/** signature shared by every kernel */
+using Kernel = void (*)(const double *, double *, size_t, double, double);
+
+/** plain loop, for other architectures */
+void scale_scalar(const double *in, double *out, size_t count, double m,
+                  double b) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = in[i] * m + b;
+    }
+}
+
+#ifdef SCALE_X86
+/** two doubles at a time. SSE2 is part of the x86-64 baseline */
+__attribute__((target("sse2")))
+void scale_sse2(const double *in, double *out, size_t count, double m,
+                double b) {
+    __m128d factor = _mm_set1_pd(m);
+    __m128d offset = _mm_set1_pd(b);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128d x = _mm_loadu_pd(in + i);
+        __m128d y = _mm_loadu_pd(in + i + 2);
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_mul_pd(x, factor), offset));
+        _mm_storeu_pd(out + i + 2, _mm_add_pd(_mm_mul_pd(y, factor), offset));
+    }
+    scale_scalar(in + i, out + i, count - i, m, b);
+}
+
+/** four doubles at a time, unrolled twice to keep both ports busy. the
+ *  multiply and add stay separate, as in Affine::apply, so every kernel
+ *  rounds the same way as a single conversion */
+__attribute__((target("avx2")))
+void scale_avx2(const double *in, double *out, size_t count, double m,
+                double b) {
+    __m256d factor = _mm256_set1_pd(m);
+    __m256d offset = _mm256_set1_pd(b);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256d x = _mm256_loadu_pd(in + i);
+        __m256d y = _mm256_loadu_pd(in + i + 4);
+        _mm256_storeu_pd(out + i,
+                         _mm256_add_pd(_mm256_mul_pd(x, factor), offset));
+        _mm256_storeu_pd(out + i + 4,
+                         _mm256_add_pd(_mm256_mul_pd(y, factor), offset));
+    }
+    scale_scalar(in + i, out + i, count - i, m, b);
+}
+#endif
+
+/** picks the best kernel for the running cpu */
+Kernel pick_kernel() {
+#ifdef SCALE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scale_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return scale_sse2;
+    }
+#endif
+    return scale_scalar;
+}
+
+}
+
+/** dispatches to the kernel chosen on first call */
+void scale(const double *in, double *out, size_t count, double multiplier,
+           double offset) {
+    static const Kernel kernel = pick_kernel();
+    kernel(in, out, count, multiplier, offset);
+}
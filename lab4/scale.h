@@ -0,0 +1,21 @@
+#ifndef SCALE_HH
+#define SCALE_HH
+
+#include <cstddef>
+using namespace std;
+
+/**
+ * computes multiplier * x + offset for every value x of an array. uses the
+ * widest vector instructions the running cpu supports (AVX2, else SSE2),
+ * picked once on first use. every kernel rounds the product before adding,
+ * as Affine::apply does, so results match converting one value at a time.
+ * 'in' and 'out' may be the same array for in-place scaling, but must not
+ * otherwise overlap.
+ * @param the input array, the output array, the number of values, the
+ *         factor to multiply by, and the offset to add
+ * @return void
+ */
+void scale(const double *in, double *out, size_t count, double multiplier,
+           double offset = 0);
+
+#endif // SCALE_HH
@@ -0,0 +1,434 @@
+#include "snapshot.h"
+#include "units.h"
+#include "mapped.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Snapshot layout. all integers are native-endian, and the arrays are
+ * ordered widest first so each one is naturally aligned in the mapping.
+ *
+ *   SnapshotHeader
+ *   double   factor[units]          conversion of each unit to its root
+ *   double   offset[units]            is factor * x + offset
+ *   double   multiplier[edges]      conversion along each edge
+ *   double   edge_offset[edges]       is multiplier * x + edge_offset
+ *   uint32_t root[units]            root of each unit
+ *   uint32_t first_edge[units + 1]  edges of unit i are [first_edge[i],
+ *                                   first_edge[i + 1]), sorted by target
+ *   uint32_t target[edges]          unit each edge converts to
+ *   uint32_t name_start[units + 1]  name of unit i is name_start[i] up to
+ *                                   name_start[i + 1] in names
+ *   uint32_t slot[slots]            open-addressed hash table of the names:
+ *                                   a name's unit is found by linear
+ *                                   probing from fnv1a(name) % slots, and
+ *                                   empty slots hold empty_slot
+ *   char     names[name_bytes]
+ *
+ * units are numbered 0..units-1 inside the file. load_snapshot interns them
+ * into the process-wide symbol table, and MappedSnapshot reads the file as
+ * it is.
+ */
+
+namespace {
+
+/** first bytes of every snapshot */
+const char snapshot_magic[8] = { 'U', 'N', 'I', 'T', 'S', 'N', 'A', 'P' };
+/** bumped whenever the layout changes */
+const uint32_t snapshot_version = 3;
+/** marks a free slot of the name hash table */
+const uint32_t empty_slot = UINT32_MAX;
+
+/** fixed-size header at the start of a snapshot */
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t units;
+    uint64_t edges;
+    uint64_t name_bytes;
+    /** size of the name hash table, a power of two */
+    uint64_t slots;
+    /** FNV-1a hash of everything after the header */
+    uint64_t checksum;
+};
+
+/** 64-bit FNV-1a, continuing from a previous hash */
+uint64_t fnv1a(const void *data, size_t size,
+               uint64_t h = 0xcbf29ce484222325ULL) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/** adds count arrays entries of the given width to a size, failing rather
+ *  than wrapping */
+bool add_size(uint64_t &total, uint64_t count, uint64_t width) {
+    uint64_t bytes;
+    return !__builtin_mul_overflow(count, width, &bytes) &&
+           !__builtin_add_overflow(total, bytes, &total);
+}
+
+/** total size of a snapshot with the counts in the header
+ *  @return false if it doesn't fit in 64 bits */
+bool snapshot_size(const SnapshotHeader &h, uint64_t &size) {
+    uint64_t units = h.units;
+    size = sizeof(SnapshotHeader);
+    return add_size(size, units, 2 * sizeof(double)) &&
+           add_size(size, h.edges, 2 * sizeof(double)) &&
+           add_size(size, units, sizeof(uint32_t)) &&
+           add_size(size, units + 1, sizeof(uint32_t)) &&
+           add_size(size, h.edges, sizeof(uint32_t)) &&
+           add_size(size, units + 1, sizeof(uint32_t)) &&
+           add_size(size, h.slots, sizeof(uint32_t)) &&
+           add_size(size, h.name_bytes, 1);
+}
+
+/** reads an array out of the mapping and steps past it */
+template <typename T>
+const T *take(const char *&p, size_t count) {
+    const T *array = reinterpret_cast<const T *>(p);
+    p += count * sizeof(T);
+    return array;
+}
+
+/** checks the magic number, version and size of a mapped snapshot */
+SnapshotHeader read_header(const MappedFile &file, const string &filename) {
+    SnapshotHeader header;
+    if ((file.size() < sizeof(header)) ||
+        (memcmp(file.data(), snapshot_magic, sizeof(snapshot_magic)) != 0)) {
+        throw invalid_argument(filename + " is not a unit snapshot");
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (header.version != snapshot_version) {
+        throw invalid_argument(filename + " has snapshot version " +
+                               to_string(header.version) + ", expected " +
+                               to_string(snapshot_version));
+    }
+    // rows and names are indexed by uint32_t, and the name table never
+    // needs more than twice as many slots as there can be units
+    if ((header.units == UINT32_MAX) || (header.edges > UINT32_MAX) ||
+        (header.name_bytes > UINT32_MAX) ||
+        (header.slots == 0) || (header.slots > (uint64_t) 2 << 32) ||
+        ((header.slots & (header.slots - 1)) != 0)) {
+        throw invalid_argument(filename + " is corrupt");
+    }
+    uint64_t size;
+    if (!snapshot_size(header, size) || (size != file.size())) {
+        throw invalid_argument(filename + " is truncated");
+    }
+    return header;
+}
+
+/** fills the name hash table, sized to at least twice the number of names
+ *  so probe runs stay short */
+vector<uint32_t> name_slots(const string &names,
+                            const vector<uint32_t> &name_start) {
+    size_t units = name_start.size() - 1;
+    size_t slots = 1;
+    while (slots < 2 * units) {
+        slots *= 2;
+    }
+
+    vector<uint32_t> slot(slots, empty_slot);
+    for (uint32_t i = 0; i < units; i++) {
+        uint64_t h = fnv1a(names.data() + name_start[i],
+                           name_start[i + 1] - name_start[i]);
+        while (slot[h % slots] != empty_slot) {
+            h++;
+        }
+        slot[h % slots] = i;
+    }
+    return slot;
+}
+
+}
+
+/** lays the known units out densely, then writes each table in turn */
+void UnitConverter::save_snapshot(const string &filename) const {
+    // number the known units 0..n-1 in id order
+    vector<uint32_t> local(nodes.size(), 0);
+    vector<node_id> global;
+    for (node_id id = 0; id < nodes.size(); id++) {
+        if (nodes[id].known) {
+            local[id] = global.size();
+            global.push_back(id);
+        }
+    }
+
+    vector<double> factor, offset, multiplier, edge_offset;
+    vector<uint32_t> root, first_edge, target, name_start;
+    string names;
+    for (node_id id : global) {
+        const Node &n = nodes[id];
+        factor.push_back(n.to_root.scale);
+        offset.push_back(n.to_root.offset);
+        root.push_back(local[n.root]);
+        first_edge.push_back(target.size());
+        // local numbers sort like ids, so rules_of gives the row in order
+        for (const auto &edge : rules_of(id)) {
+            target.push_back(local[edge.first]);
+            multiplier.push_back(edge.second.scale);
+            edge_offset.push_back(edge.second.offset);
+        }
+        name_start.push_back(names.size());
+        names += UnitSymbols::name(id);
+    }
+    first_edge.push_back(target.size());
+    name_start.push_back(names.size());
+    vector<uint32_t> slot = name_slots(names, name_start);
+
+    SnapshotHeader header;
+    memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version    = snapshot_version;
+    header.units      = global.size();
+    header.edges      = target.size();
+    header.name_bytes = names.size();
+    header.slots      = slot.size();
+
+    // the checksum covers the payload in the order it is written
+    uint64_t h = fnv1a(factor.data(), factor.size() * sizeof(double));
+    h = fnv1a(offset.data(), offset.size() * sizeof(double), h);
+    h = fnv1a(multiplier.data(), multiplier.size() * sizeof(double), h);
+    h = fnv1a(edge_offset.data(), edge_offset.size() * sizeof(double), h);
+    h = fnv1a(root.data(), root.size() * sizeof(uint32_t), h);
+    h = fnv1a(first_edge.data(), first_edge.size() * sizeof(uint32_t), h);
+    h = fnv1a(target.data(), target.size() * sizeof(uint32_t), h);
+    h = fnv1a(name_start.data(), name_start.size() * sizeof(uint32_t), h);
+    h = fnv1a(slot.data(), slot.size() * sizeof(uint32_t), h);
+    h = fnv1a(names.data(), names.size(), h);
+    header.checksum = h;
+
+    ofstream ofs{filename, ios::binary | ios::trunc};
+    if (!ofs) {
+        throw invalid_argument("Couldn't open " + filename);
+    }
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char *>(factor.data()),
+              factor.size() * sizeof(double));
+    ofs.write(reinterpret_cast<const char *>(offset.data()),
+              offset.size() * sizeof(double));
+    ofs.write(reinterpret_cast<const char *>(multiplier.data()),
+              multiplier.size() * sizeof(double));
+    ofs.write(reinterpret_cast<const char *>(edge_offset.data()),
+              edge_offset.size() * sizeof(double));
+    ofs.write(reinterpret_cast<const char *>(root.data()),
+              root.size() * sizeof(uint32_t));
+    ofs.write(reinterpret_cast<const char *>(first_edge.data()),
+              first_edge.size() * sizeof(uint32_t));
+    ofs.write(reinterpret_cast<const char *>(target.data()),
+              target.size() * sizeof(uint32_t));
+    ofs.write(reinterpret_cast<const char *>(name_start.data()),
+              name_start.size() * sizeof(uint32_t));
+    ofs.write(reinterpret_cast<const char *>(slot.data()),
+              slot.size() * sizeof(uint32_t));
+    ofs.write(names.data(), names.size());
+    if (!ofs) {
+        throw invalid_argument("Couldn't write " + filename);
+    }
+}
+
+/** checks the header and checksum, then copies the tables in */
+UnitConverter UnitConverter::load_snapshot
+(   const string &filename, size_t cache_capacity   )
+{
+    MappedFile file{filename};
+    SnapshotHeader header = read_header(file, filename);
+
+    const char *payload = file.data() + sizeof(header);
+    if (fnv1a(payload, file.size() - sizeof(header)) != header.checksum) {
+        throw invalid_argument(filename + " fails its checksum");
+    }
+
+    const char *p = payload;
+    const double   *factor      = take<double>(p, header.units);
+    const double   *offset      = take<double>(p, header.units);
+    const double   *multiplier  = take<double>(p, header.edges);
+    const double   *edge_offset = take<double>(p, header.edges);
+    const uint32_t *root        = take<uint32_t>(p, header.units);
+    const uint32_t *first_edge  = take<uint32_t>(p, header.units + 1);
+    const uint32_t *target      = take<uint32_t>(p, header.edges);
+    const uint32_t *name_start  = take<uint32_t>(p, header.units + 1);
+    take<uint32_t>(p, header.slots);
+    const char     *names       = take<char>(p, header.name_bytes);
+
+    // indices are checked so a damaged file can't reach outside the tables
+    for (uint32_t i = 0; i < header.units; i++) {
+        if ((root[i] >= header.units) || (first_edge[i] > first_edge[i + 1]) ||
+            (name_start[i] > name_start[i + 1])) {
+            throw invalid_argument(filename + " is corrupt");
+        }
+    }
+    if ((first_edge[header.units] != header.edges) ||
+        (name_start[header.units] != header.name_bytes)) {
+        throw invalid_argument(filename + " is corrupt");
+    }
+    for (uint64_t e = 0; e < header.edges; e++) {
+        if (target[e] >= header.units) {
+            throw invalid_argument(filename + " is corrupt");
+        }
+    }
+
+    // names are the only thing that has to be hashed, to find global ids
+    vector<node_id> global(header.units);
+    for (uint32_t i = 0; i < header.units; i++) {
+        global[i] = UnitSymbols::intern(
+            string(names + name_start[i], name_start[i + 1] - name_start[i]));
+    }
+
+    UnitConverter u{cache_capacity};
+    u.reserve_units(UnitSymbols::size());
+    for (uint32_t i = 0; i < header.units; i++) {
+        Node &n   = u.nodes[global[i]];
+        n.known   = true;
+        n.root    = global[root[i]];
+        n.to_root = Affine{factor[i], offset[i]};
+        // exact rules are saved rounded, so each unit is its own exact base
+        n.exact_base = global[i];
+        n.edges.reserve(first_edge[i + 1] - first_edge[i]);
+        for (uint32_t e = first_edge[i]; e < first_edge[i + 1]; e++) {
+            n.edges.emplace(global[target[e]],
+                            Affine{multiplier[e], edge_offset[e]});
+        }
+        u.nodes[n.root].members.push_back(global[i]);
+    }
+    return u;
+}
+
+/** compares the first bytes of the file to the magic number */
+bool UnitConverter::is_snapshot(const string &filename) {
+    char magic[sizeof(snapshot_magic)];
+    ifstream ifs{filename, ios::binary};
+    return ifs.read(magic, sizeof(magic)) &&
+           (memcmp(magic, snapshot_magic, sizeof(magic)) == 0);
+}
+
+/** only the header and the ends of the tables are read here, so opening
+ *  takes constant time */
+MappedSnapshot::MappedSnapshot(const string &filename) : file(filename) {
+    SnapshotHeader header = read_header(file, filename);
+    unit_total = header.units;
+    edges      = header.edges;
+    slots      = header.slots;
+    name_bytes = header.name_bytes;
+
+    const char *p = file.data() + sizeof(header);
+    factor      = take<double>(p, unit_total);
+    offset      = take<double>(p, unit_total);
+    multiplier  = take<double>(p, edges);
+    edge_offset = take<double>(p, edges);
+    root        = take<uint32_t>(p, unit_total);
+    first_edge  = take<uint32_t>(p, unit_total + 1);
+    target      = take<uint32_t>(p, edges);
+    name_start  = take<uint32_t>(p, unit_total + 1);
+    slot        = take<uint32_t>(p, slots);
+    names       = take<char>(p, name_bytes);
+
+    // the ends of the rows and names are checked once here, and every
+    // other index as it is read
+    if ((first_edge[unit_total] != edges) ||
+        (name_start[unit_total] != name_bytes)) {
+        throw invalid_argument(filename + " is corrupt");
+    }
+}
+
+/** the same hash load_snapshot checks */
+bool MappedSnapshot::verify() const {
+    SnapshotHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    return fnv1a(file.data() + sizeof(header),
+                 file.size() - sizeof(header)) == header.checksum;
+}
+
+size_t MappedSnapshot::unit_count() const {
+    return unit_total;
+}
+
+/** every rule is stored as an edge in each direction */
+size_t MappedSnapshot::rule_count() const {
+    return edges / 2;
+}
+
+/** linear probing from the name's hash, as save_snapshot filled the table */
+bool MappedSnapshot::find_units(const string &units, unit_id &id) const {
+    uint64_t h = fnv1a(units.data(), units.size());
+    for (uint64_t k = 0; k < slots; k++) {
+        uint32_t i = slot[(h + k) & (slots - 1)];
+        if ((i == empty_slot) || (i >= unit_total)) {
+            return false;
+        }
+        uint32_t start = name_start[i], end = name_start[i + 1];
+        if ((start <= end) && (end <= name_bytes) &&
+            (units.compare(0, string::npos, names + start, end - start)
+             == 0)) {
+            id = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/** binary search of the row, which save_snapshot sorted by target */
+bool MappedSnapshot::find_edge
+(   uint32_t from, uint32_t to, uint64_t &edge   ) const
+{
+    uint64_t lo = first_edge[from], hi = first_edge[from + 1];
+    if ((lo > hi) || (hi > edges)) {
+        return false;
+    }
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (target[mid] < to) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if ((lo == first_edge[from + 1]) || (target[lo] != to)) {
+        return false;
+    }
+    edge = lo;
+    return true;
+}
+
+/** the same order as UnitConverter::resolve: a direct rule, then the root */
+bool MappedSnapshot::find_conversion
+(   unit_id from_units, unit_id to_units, Affine &conversion   ) const
+{
+    if ((from_units >= unit_total) || (to_units >= unit_total)) {
+        return false;
+    }
+
+    uint64_t edge;
+    if (find_edge(from_units, to_units, edge)) {
+        conversion = Affine{multiplier[edge], edge_offset[edge]};
+        return true;
+    }
+    if (root[from_units] != root[to_units]) {
+        return false;
+    }
+
+    Affine f{factor[from_units], offset[from_units]};
+    Affine t{factor[to_units], offset[to_units]};
+    conversion = Affine{f.scale / t.scale, (f.offset - t.offset) / t.scale};
+    return true;
+}
+
+/** converts through find_conversion */
+optional<double> MappedSnapshot::try_convert
+(   double value, unit_id from_units, unit_id to_units   ) const
+{
+    Affine conversion;
+    if (!find_conversion(from_units, to_units, conversion)) {
+        return nullopt;
+    }
+    return conversion.apply(value);
+}
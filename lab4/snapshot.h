@@ -0,0 +1,113 @@
+#ifndef SNAPSHOT_HH
+#define SNAPSHOT_HH
+
+#include "units.h"
+#include "mapped.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+using namespace std;
+
+/**
+ * a snapshot written by UnitConverter::save_snapshot, read in place. the
+ * file is mapped and lookups read its arrays directly: names are found
+ * through the hash table stored in the file, and conversions through the
+ * stored roots and rows, so opening one takes the same time however many
+ * rules it holds. units are numbered by their position in the snapshot,
+ * not by interned id, and nothing is interned. unit expressions and
+ * prefixed units aren't parsed; load_snapshot builds a full converter for
+ * those. the checksum is only checked by verify, since that reads the
+ * whole file, but every index is checked as it is read, so a damaged file
+ * can give wrong answers but never reads outside the mapping. lookups
+ * change nothing, so any number of threads may share one.
+ */
+class MappedSnapshot {
+    /** the whole file */
+    MappedFile file;
+    /** number of units, rules stored in each direction, and hash slots */
+    uint32_t unit_total;
+    uint64_t edges;
+    uint64_t slots;
+    /** the arrays of the file, as laid out in snapshot.cpp */
+    const double   *factor;
+    const double   *offset;
+    const double   *multiplier;
+    const double   *edge_offset;
+    const uint32_t *root;
+    const uint32_t *first_edge;
+    const uint32_t *target;
+    const uint32_t *name_start;
+    const uint32_t *slot;
+    const char     *names;
+    uint64_t        name_bytes;
+
+    /**
+     * finds the rule given for a pair of units by binary search of the
+     * first unit's row
+     * @param the two units, and where to store the rule's index
+     * @return true if a rule joins the two units directly
+     */
+    bool find_edge(uint32_t from, uint32_t to, uint64_t &edge) const;
+
+public:
+    /**
+     * constructor - maps a snapshot and checks its header, its size, and
+     * the ends of its tables
+     * throws invalid_argument if the file is missing, truncated, corrupt,
+     * or not a snapshot of this version
+     * @param the name of the snapshot file
+     */
+    MappedSnapshot(const string &filename);
+
+    /** methods */
+    /**
+     * checks the snapshot's checksum. reads the whole file
+     * @param void
+     * @return true if the contents match the checksum in the header
+     */
+    bool verify() const;
+
+    /**
+     * counts the units in the snapshot
+     * @param void
+     * @return the number of units
+     */
+    size_t unit_count() const;
+
+    /**
+     * counts the rules, each counted once for both directions
+     * @param void
+     * @return the number of rules
+     */
+    size_t rule_count() const;
+
+    /**
+     * finds a unit by name through the snapshot's hash table
+     * @param the unit name, and where to store its number
+     * @return true if the unit is in the snapshot
+     */
+    bool find_units(const string &units, unit_id &id) const;
+
+    /**
+     * resolves the conversion between two units as UnitConverter::resolve
+     * does: a rule given for the pair is used as written, otherwise the
+     * conversion goes through the shared root
+     * @param the numbers of the units to convert from and to, and where to
+     *         store the conversion
+     * @return true if the units are convertible
+     */
+    bool find_conversion(unit_id from_units, unit_id to_units,
+                         Affine &conversion) const;
+
+    /**
+     * converts a value between two units
+     * @param the value, and the numbers of the units to convert from and to
+     * @return the converted value, or nothing if the units are not
+     *         convertible
+     */
+    optional<double> try_convert(double value, unit_id from_units,
+                                 unit_id to_units) const;
+};
+
+#endif // SNAPSHOT_HH
@@ -0,0 +1,114 @@
+#ifndef STATIC_CONVERTER_HH
+#define STATIC_CONVERTER_HH
+
+#include "rules_hash.h"
+#include "rules_table.h"
+#include <cstdint>
+#include <optional>
+#include <string_view>
+using namespace std;
+
+/**
+ * converter over the tables genrules generated from rules.txt at build
+ * time. every method is constexpr: nothing is built at startup and nothing
+ * is allocated, and conversions between literal unit names fold to a
+ * constant. conversions resolve as UnitConverter's do: a rule given for
+ * the pair is used as written, otherwise the conversion goes through the
+ * shared root, so both give the same answers.
+ */
+class StaticConverter {
+    /**
+     * finds the rule given for a pair of units by binary search of the
+     * first unit's row
+     * @param the indices of the two units
+     * @return the rule's index in the edge tables, or -1 if there is none
+     */
+    static constexpr int32_t find_rule(int32_t from, int32_t to) {
+        using namespace rules_table;
+        uint32_t lo = first_edge[from], hi = first_edge[from + 1];
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (edge_target[mid] < uint32_t(to)) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        bool found = (lo < first_edge[from + 1]) &&
+                     (edge_target[lo] == uint32_t(to));
+        return found ? int32_t(lo) : -1;
+    }
+
+public:
+    /**
+     * finds a unit in the tables through the perfect hash
+     * @param the unit name
+     * @return the unit's index in the tables, or -1 if it is unknown
+     */
+    static constexpr int32_t find(string_view units) {
+        using namespace rules_table;
+        uint32_t s = seed[rules_hash(units, 0) % bucket_count];
+        int32_t i  = slot[rules_hash(units, s) % slot_count];
+        return ((i >= 0) && (units == names[i])) ? i : -1;
+    }
+
+    /**
+     * checks whether two units are connected by the rules
+     * @param the units to convert from and to
+     * @return true if the units are convertible
+     */
+    static constexpr bool can_convert(string_view from_units,
+                                      string_view to_units) {
+        int32_t from = find(from_units);
+        int32_t to   = find(to_units);
+        return (from >= 0) && (to >= 0) &&
+               (rules_table::root[from] == rules_table::root[to]);
+    }
+
+    /**
+     * gets the ratio between two units, leaving out any offset
+     * @param the units to convert from and to
+     * @return how many to_units make one from_units, or nothing if the
+     *         units are not convertible
+     */
+    static constexpr optional<double> multiplier(string_view from_units,
+                                                 string_view to_units) {
+        using namespace rules_table;
+        if (!can_convert(from_units, to_units)) {
+            return nullopt;
+        }
+        int32_t from = find(from_units);
+        int32_t to   = find(to_units);
+        int32_t rule = find_rule(from, to);
+        return (rule >= 0) ? edge_factor[rule] : factor[from] / factor[to];
+    }
+
+    /**
+     * converts a value between two units
+     * @param the value, and the units to convert from and to
+     * @return the converted value, or nothing if the units are not
+     *         convertible
+     */
+    static constexpr optional<double> convert(double value,
+                                              string_view from_units,
+                                              string_view to_units) {
+        using namespace rules_table;
+        if (!can_convert(from_units, to_units)) {
+            return nullopt;
+        }
+        int32_t from = find(from_units);
+        int32_t to   = find(to_units);
+        int32_t rule = find_rule(from, to);
+        if (rule >= 0) {
+            return edge_factor[rule] * value + edge_offset[rule];
+        }
+
+        // up to the shared root and back down, composed as Affine does
+        double scale = factor[from] / factor[to];
+        double shift = (offset[from] - offset[to]) / factor[to];
+        return scale * value + shift;
+    }
+};
+
+#endif // STATIC_CONVERTER_HH
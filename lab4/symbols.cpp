@@ -0,0 +1,64 @@
+#include "symbols.h"
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+/** the table is built on first use, so it is ready during static init */
+unordered_map<string, unit_id> &UnitSymbols::ids() {
+    static unordered_map<string, unit_id> table;
+    return table;
+}
+
+deque<string> &UnitSymbols::names() {
+    static deque<string> table;
+    return table;
+}
+
+shared_mutex &UnitSymbols::lock() {
+    static shared_mutex table_lock;
+    return table_lock;
+}
+
+/** returns the existing id, or hands out the next one */
+unit_id UnitSymbols::intern(const string &units) {
+    unit_id id;
+    if (find(units, id)) {
+        return id;
+    }
+
+    // another thread may have added it between the two locks
+    unique_lock<shared_mutex> writing(lock());
+    auto it = ids().find(units);
+    if (it != ids().end()) {
+        return it->second;
+    }
+    id = names().size();
+    names().push_back(units);
+    ids().emplace(units, id);
+    return id;
+}
+
+/** looks up a name without adding it */
+bool UnitSymbols::find(const string &units, unit_id &id) {
+    shared_lock<shared_mutex> reading(lock());
+    auto it = ids().find(units);
+    if (it == ids().end()) {
+        return false;
+    }
+    id = it->second;
+    return true;
+}
+
+/** returns the name an id was interned from. deque elements never move,
+ *  so the reference outlives the lock */
+const string &UnitSymbols::name(unit_id id) {
+    shared_lock<shared_mutex> reading(lock());
+    return names()[id];
+}
+
+/** returns the number of names interned so far */
+size_t UnitSymbols::size() {
+    shared_lock<shared_mutex> reading(lock());
+    return names().size();
+}
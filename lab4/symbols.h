@@ -0,0 +1,59 @@
+#ifndef SYMBOLS_HH
+#define SYMBOLS_HH
+
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+/** small integer standing in for a unit name */
+using unit_id = uint32_t;
+
+/**
+ * process-wide table interning unit names. every name gets one id the
+ * first time it is seen, so units can be stored and compared as integers
+ * and only turned back into names for I/O.
+ * safe to use from several threads: lookups share a lock, and only
+ * interning a new name takes it exclusively.
+ */
+class UnitSymbols {
+    /** id of every interned name */
+    static unordered_map<string, unit_id> &ids();
+    /** name of every id. a deque keeps references stable as it grows */
+    static deque<string> &names();
+    /** guards both tables */
+    static shared_mutex &lock();
+
+public:
+    /**
+     * gets the id of a unit name, interning it if it is new
+     * @param the unit name
+     * @return the unit's id
+     */
+    static unit_id intern(const string &units);
+
+    /**
+     * gets the id of a unit name without interning it
+     * @param the unit name, and where to store its id
+     * @return true if the name was already interned
+     */
+    static bool find(const string &units, unit_id &id);
+
+    /**
+     * gets the name of an interned unit
+     * @param the unit's id
+     * @return the unit name
+     */
+    static const string &name(unit_id id);
+
+    /**
+     * gets the number of interned names. ids are always below this
+     * @param void
+     * @return the number of interned names
+     */
+    static size_t size();
+};
+
+#endif // SYMBOLS_HH
@@ -1,7 +1,14 @@
 #include "units.h"
+#include "scale.h"
 #include <string>
 #include <stdexcept>
 #include <set>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <atomic>
 
 
 using namespace std;
@@ -10,8 +17,12 @@ using namespace std;
 UValue::UValue(double value, const string units) {
     /** numerical value of the data */
     this->value = value;
-    /** string representation of the units of the data */
-    this->units = units;
+    /** interned id of the units of the data */
+    this->units = UnitSymbols::intern(units);
+}
+
+/** constructor for units that are already interned */
+UValue::UValue(double value, unit_id units) : value(value), units(units) {
 }
 
 /** returns value of a UValue */
@@ -20,62 +31,1104 @@ double UValue::get_value() const {
 }
 
 /** returns the units of a UValue */
-string UValue::get_units() const {
+const string &UValue::get_units() const {
+    return UnitSymbols::name(units);
+}
+
+/** returns the interned units of a UValue */
+unit_id UValue::get_unit_id() const {
     return units;
 }
 
-/** adds a conversion to the list of conversions if it is not currently there
+/** adds in this value's units */
+UValue &UValue::operator+=(const UValue &other) {
+    value += BoundConverter::convert(other, units).value;
+    return *this;
+}
+
+UValue &UValue::operator-=(const UValue &other) {
+    value -= BoundConverter::convert(other, units).value;
+    return *this;
+}
+
+UValue &UValue::operator*=(double k) {
+    value *= k;
+    return *this;
+}
+
+UValue &UValue::operator/=(double k) {
+    value /= k;
+    return *this;
+}
+
+UValue UValue::operator-() const {
+    return UValue{-value, units};
+}
+
+/** an SI prefix and the power of ten it stands for */
+struct SIPrefix {
+    const char *symbol;
+    double factor;
+};
+
+/** every SI prefix. "da" comes before "d", so the longer prefix is tried
+ *  first. micro may be written with the micro sign, a Greek mu or a u */
+static const SIPrefix si_prefixes[] = {
+    {"da", 1e1},   {"\u00b5", 1e-6}, {"\u03bc", 1e-6},
+    {"Q", 1e30},   {"R", 1e27},     {"Y", 1e24},     {"Z", 1e21},
+    {"E", 1e18},   {"P", 1e15},     {"T", 1e12},     {"G", 1e9},
+    {"M", 1e6},    {"k", 1e3},      {"h", 1e2},      {"d", 1e-1},
+    {"c", 1e-2},   {"m", 1e-3},     {"u", 1e-6},     {"n", 1e-9},
+    {"p", 1e-12},  {"f", 1e-15},    {"a", 1e-18},    {"z", 1e-21},
+    {"y", 1e-24},  {"r", 1e-27},    {"q", 1e-30},
+};
+
+/** whether a name is a prefix followed by at least one more character */
+static bool starts_with_prefix(const string &units, const SIPrefix &prefix) {
+    size_t length = strlen(prefix.symbol);
+    return (units.size() > length) &&
+           (units.compare(0, length, prefix.symbol) == 0);
+}
+
+/** hands out rules versions, unique across every converter */
+static uint64_t next_rules_version() {
+    static atomic<uint64_t> last{0};
+    return ++last;
+}
+
+/** a plan is a resolved conversion plus where it came from */
+ConversionPlan::ConversionPlan
+(   unit_id from, unit_id to, const Affine &conversion, uint64_t rules_version
+)
+    : from(from), to(to), conversion(conversion), rules_version(rules_version)
+{
+}
+
+unit_id ConversionPlan::from_units() const {
+    return from;
+}
+
+unit_id ConversionPlan::to_units() const {
+    return to;
+}
+
+const Affine &ConversionPlan::get_conversion() const {
+    return conversion;
+}
+
+uint64_t ConversionPlan::version() const {
+    return rules_version;
+}
+
+/** the unit check is one integer compare */
+UValue ConversionPlan::operator()(const UValue &input) const {
+    if (input.get_unit_id() != from) {
+        string e_message = "Plan converts from " + UnitSymbols::name(from) \
+                           + ", not " + input.get_units();
+        throw invalid_argument(e_message);
+    }
+    return UValue{conversion.apply(input.get_value()), to};
+}
+
+/** hands the array straight to the scale kernel */
+void ConversionPlan::operator()
+(   const double *in, double *out, size_t count   ) const
+{
+    scale(in, out, count, conversion.scale, conversion.offset);
+}
+
+void ConversionPlan::operator()(vector<double> &values) const {
+    scale(values.data(), values.data(), values.size(), conversion.scale,
+          conversion.offset);
+}
+
+/** empty converter with a bounded conversion cache */
+UnitConverter::UnitConverter(size_t cache_capacity)
+    : generation(0), unreachable(0), cache_capacity(cache_capacity),
+      stats{0, 0, 0}, rules_version(next_rules_version()) {
+}
+
+/** copies everything but the cache */
+UnitConverter::UnitConverter(const UnitConverter &other)
+    : nodes(other.nodes), stamp(other.stamp), parent(other.parent),
+      reach(other.reach), generation(other.generation),
+      compounds(other.compounds), unreachable(0),
+      cache_capacity(other.cache_capacity), stats{0, 0, 0},
+      rules_version(other.rules_version) {
+}
+
+/** copies into a temporary and moves it in */
+UnitConverter &UnitConverter::operator=(const UnitConverter &other) {
+    if (this != &other) {
+        *this = UnitConverter(other);
+    }
+    return *this;
+}
+
+/** adds a conversion to the graph if it is not currently there
  * throws invalid_argument error if conversion already exists
  */
 void UnitConverter::add_conversion
-(   const string from_units, double multiplier, const string to_units   )
+(   const string &from_units, double multiplier, const string &to_units,
+    double offset
+)
 {
+    Affine conversion{multiplier, offset};
+    add_rule(from_units, conversion, conversion.inverse(), to_units, nullptr);
+}
+
+/** both directions are rounded from the exact rule, so the reverse edge is
+ *  the nearest double to the true inverse rather than 1 / a rounded value
+ */
+void UnitConverter::add_conversion
+(   const string &from_units, const Rational &multiplier,
+    const string &to_units, const Rational &offset
+)
+{
+    if (multiplier == Rational()) {
+        string e_message = "Conversion from " + from_units + " to " \
+                           + to_units + " has a zero multiplier";
+        throw invalid_argument(e_message);
+    }
+
+    ExactAffine exact{multiplier, offset};
+    try {
+        add_rule(from_units, exact.rounded(), exact.inverse().rounded(),
+                 to_units, &exact);
+    }
+    catch (overflow_error &e) {
+        // the inverse offset doesn't fit, so the rule is only approximate
+        add_conversion(from_units, multiplier.to_double(), to_units,
+                       offset.to_double());
+    }
+}
+
+/** the shared part of both add_conversion overloads */
+void UnitConverter::add_rule
+(   const string &from_units, const Affine &conversion, const Affine &inverse,
+    const string &to_units, const ExactAffine *exact
+)
+{
+    node_id from = add_unit(from_units);
+    node_id to   = add_unit(to_units);
+
     // Verify that the conversion doesn't already appear in the object!
-    for (Conversion c : items) {
+    if (nodes[from].edges.count(to) != 0) {
         // If this case occurs, method should throw invalid_argument exception.
-        if ((c.from_units == from_units) && (c.to_units == to_units)) {
-            string e_message = "Already have a conversion from " + from_units \
-                               + " to " + to_units;
-            throw invalid_argument(e_message);
-        }
+        string e_message = "Already have a conversion from " + from_units \
+                           + " to " + to_units;
+        throw invalid_argument(e_message);
     }
 
     // if exception not thrown, we can proceed to add conversion
-    items.push_back({from_units, multiplier, to_units});
-    items.push_back({to_units, (1 / multiplier), from_units});
+    nodes[from].edges.emplace(to, conversion);
+    nodes[to].edges.emplace(from, inverse);
+    join(from, conversion, to, exact);
+    rules_version = next_rules_version();
+
+    // merging keeps every ratio that was exact, and join drops pairs that
+    // become exact. a rule for exactly this pair overrides what was cached
+    // for it
+    forget({from, to});
+    forget({to, from});
+}
+
+/** looks up the id of a unit name that appears in a rule */
+bool UnitConverter::find_unit(const string &units, node_id &id) const {
+    return UnitSymbols::find(units, id) && known(id);
+}
+
+/** ids past the end of the table were interned after the last rule */
+bool UnitConverter::known(node_id id) const {
+    return (id < nodes.size()) && nodes[id].known;
+}
+
+/** new slots are unknown units */
+void UnitConverter::reserve_units(size_t size) {
+    if (size > nodes.size()) {
+        nodes.resize(size, Node{false, {}, 0, Affine{1, 0}, {}, 0,
+                                ExactAffine{1, 0}, {}});
+        stamp.resize(size, 0);
+        parent.resize(size, 0);
+        reach.resize(size, Affine{1, 0});
+    }
+}
+
+/** starts a new component holding only this unit */
+UnitConverter::node_id UnitConverter::add_unit(const string &units) {
+    node_id id = UnitSymbols::intern(units);
+    if (id >= nodes.size()) {
+        reserve_units(UnitSymbols::size());
+    }
+    if (!nodes[id].known) {
+        nodes[id] = Node{true, {}, id, Affine{1, 0}, {id}, id,
+                         ExactAffine{1, 0}, {}};
+
+        // a name used as an expression or prefixed unit is now a unit of
+        // its own, so pairs resolved through it, or through an expression
+        // naming it, may no longer hold. the parse cache is emptied too
+        // often to tell which were, so all such pairs are dropped
+        if (!lru.empty()) {
+            forget_unit(id);
+        }
+        compounds.clear();
+    }
+    return id;
+}
+
+/** weighted union of the components of from and to */
+void UnitConverter::join
+(   node_id from, const Affine &conversion, node_id to,
+    const ExactAffine *exact
+)
+{
+    node_id keep = nodes[from].root;
+    node_id gone = nodes[to].root;
+
+    // units already connected may only have their exact bases merged
+    if (exact != nullptr) {
+        join_exact(from, *exact, to, keep != gone);
+    }
+    if (keep == gone) {
+        return;
+    }
+
+    // converts the old root of 'to' to the root of 'from', by way of 'to'
+    // and 'from'. written out so plain ratios round the same as a quotient
+    const Affine &f = nodes[from].to_root;
+    const Affine &t = nodes[to].to_root;
+    Affine link{f.scale / (conversion.scale * t.scale),
+                f.offset - f.scale * (t.offset / t.scale + conversion.offset)
+                           / conversion.scale};
+
+    // relabel the smaller component so the work stays O(n log n) overall
+    if (nodes[keep].members.size() < nodes[gone].members.size()) {
+        swap(keep, gone);
+        link = link.inverse();
+    }
+
+    // units reaching the new root through exact rules alone take the
+    // rounded exact conversion, so they agree however they are resolved
+    vector<node_id> &kept = nodes[keep].members;
+    for (node_id u : nodes[gone].members) {
+        Node &n   = nodes[u];
+        n.root    = keep;
+        n.to_root = (n.exact_base == keep) ? n.exact_root.rounded()
+                                           : link.after(n.to_root);
+        kept.push_back(u);
+    }
+    vector<node_id>().swap(nodes[gone].members);
+
+    // parsed expressions refer to the old roots
+    compounds.clear();
+
+    // pairs that spanned the two components are convertible now
+    if (unreachable != 0) {
+        forget_unreachable();
+    }
+}
+
+/** the exact bases merge like the roots. a double rule leaves them as they
+ *  were, so ratios that were exact stay exact */
+void UnitConverter::join_exact
+(   node_id from, const ExactAffine &exact, node_id to, bool merged   )
+{
+    node_id keep = nodes[from].exact_base;
+    node_id gone = nodes[to].exact_base;
+    if (keep == gone) {
+        return;
+    }
+
+    // a base stands alone until an exact rule reaches it, so its member
+    // list isn't allocated for rule sets without any
+    for (node_id base : {keep, gone}) {
+        if (nodes[base].exact_members.empty()) {
+            nodes[base].exact_members.push_back(base);
+        }
+    }
+
+    // converts the exact base of 'to' to the exact base of 'from', and
+    // every unit moved onto the new base. if anything overflows the two
+    // bases stay apart, which only costs exactness
+    vector<ExactAffine> moved;
+    try {
+        ExactAffine link = nodes[from].exact_root.after(
+            exact.inverse().after(nodes[to].exact_root.inverse()));
+        if (nodes[keep].exact_members.size() <
+            nodes[gone].exact_members.size()) {
+            swap(keep, gone);
+            link = link.inverse();
+        }
+        moved.reserve(nodes[gone].exact_members.size());
+        for (node_id u : nodes[gone].exact_members) {
+            moved.push_back(link.after(nodes[u].exact_root));
+        }
+    }
+    catch (overflow_error &e) {
+        return;
+    }
+
+    vector<node_id> &kept = nodes[keep].exact_members;
+    for (size_t i = 0; i < moved.size(); i++) {
+        node_id u    = nodes[gone].exact_members[i];
+        Node &n      = nodes[u];
+        n.exact_base = keep;
+        n.exact_root = moved[i];
+        kept.push_back(u);
+    }
+    vector<node_id>().swap(nodes[gone].exact_members);
+
+    // pairs across the two bases were resolved from doubles before, and
+    // now compose exactly
+    if (!merged) {
+        for (auto it = lru.begin(); it != lru.end(); ) {
+            node_id a = it->first.first, b = it->first.second;
+            if (!known(a) || !known(b) || (nodes[a].exact_base != keep) ||
+                (nodes[b].exact_base != keep)) {
+                ++it;
+                continue;
+            }
+            cache.erase(it->first);
+            it = lru.erase(it);
+        }
+    }
+}
+
+/** two units are convertible iff they share a component root */
+bool UnitConverter::can_convert
+(   const string &from_units, const string &to_units   ) const
+{
+    node_id from, to;
+    if (!find_units(from_units, from) || !find_units(to_units, to)) {
+        return false;
+    }
+    if (known(from) && known(to)) {
+        return nodes[from].root == nodes[to].root;
+    }
+
+    Compound a, b;
+    return compound_of(from, a) && compound_of(to, b) && (a.dims == b.dims);
+}
+
+/** known units are their own one-term expression */
+bool UnitConverter::compound_of
+(   node_id id, Compound &result, bool remember   ) const
+{
+    if (known(id)) {
+        const Affine &t = nodes[id].to_root;
+        result = Compound{t.offset == 0, {{nodes[id].root, 1}}, t.scale};
+        return result.valid;
+    }
+
+    auto it = compounds.find(id);
+    if ((it == compounds.end()) && !remember) {
+        return parse_compound(UnitSymbols::name(id), result);
+    }
+    if (it == compounds.end()) {
+        Compound parsed;
+        parse_compound(UnitSymbols::name(id), parsed);
+        it = compounds.emplace(id, move(parsed)).first;
+    }
+    result = it->second;
+    return result.valid;
+}
+
+/** parses straight from the name, so nothing is interned */
+bool UnitConverter::compound_of(const string &units, Compound &result) const
+{
+    node_id id;
+    if (UnitSymbols::find(units, id)) {
+        return compound_of(id, result, false);
+    }
+    if ((units.find_first_of("*/^") == string::npos) &&
+        !maybe_prefixed(units)) {
+        return false;
+    }
+    return parse_compound(units, result);
+}
+
+/** accumulates exponents per root while walking the expression */
+bool UnitConverter::parse_compound(const string &expr, Compound &result) const
+{
+    result = Compound{false, {}, 1.0};
+    map<node_id, int> exponents;
+    int sign = 1;
+
+    size_t pos = 0;
+    while (true) {
+        // the next factor runs up to an operator or the end
+        size_t end = expr.find_first_of("*/^", pos);
+        if (end == string::npos) {
+            end = expr.size();
+        }
+        if (end == pos) {
+            return false;
+        }
+        string atom = expr.substr(pos, end - pos);
+
+        int power = 1;
+        if ((end < expr.size()) && (expr[end] == '^')) {
+            const char *first = expr.data() + end + 1;
+            const char *last  = expr.data() + expr.size();
+            auto parsed = from_chars(first, last, power);
+            if ((parsed.ec != errc{}) || (parsed.ptr == first)) {
+                return false;
+            }
+            end = parsed.ptr - expr.data();
+        }
+        power *= sign;
+
+        // plain numbers only scale the expression
+        double number, prefix;
+        node_id id;
+        const char *atom_end = atom.data() + atom.size();
+        auto parsed = from_chars(atom.data(), atom_end, number);
+        if ((parsed.ec == errc{}) && (parsed.ptr == atom_end)) {
+            result.scale *= pow(number, power);
+        }
+        else if (find_unit(atom, id)) {
+            if (nodes[id].to_root.offset != 0) {
+                return false;
+            }
+            exponents[nodes[id].root] += power;
+            result.scale *= pow(nodes[id].to_root.scale, power);
+        }
+        else if (find_prefixed(atom, prefix, id)) {
+            // the prefix binds to its unit, so km^2 is a million m^2
+            exponents[nodes[id].root] += power;
+            result.scale *= pow(prefix * nodes[id].to_root.scale, power);
+        }
+        else {
+            return false;
+        }
+
+        if (end == expr.size()) {
+            break;
+        }
+        if ((expr[end] != '*') && (expr[end] != '/')) {
+            return false;
+        }
+        sign = (expr[end] == '*') ? 1 : -1;
+        pos  = end + 1;
+    }
+
+    for (const auto &e : exponents) {
+        if (e.second != 0) {
+            result.dims.push_back(e);
+        }
+    }
+    result.valid = (result.scale != 0) && isfinite(result.scale);
+    return result.valid;
+}
+
+/** the first prefix whose remainder is a unit in the rules wins */
+bool UnitConverter::find_prefixed
+(   const string &units, double &factor, node_id &base   ) const
+{
+    for (const SIPrefix &prefix : si_prefixes) {
+        if (starts_with_prefix(units, prefix) &&
+            find_unit(units.substr(strlen(prefix.symbol)), base) &&
+            (nodes[base].to_root.offset == 0)) {
+            factor = prefix.factor;
+            return true;
+        }
+    }
+    return false;
+}
+
+/** a unit in the rules scales by 1 */
+bool UnitConverter::find_scaled
+(   const string &units, double &factor, node_id &id   ) const
+{
+    if (find_unit(units, id)) {
+        factor = 1;
+        return true;
+    }
+    return find_prefixed(units, factor, id);
+}
+
+/** only the symbol table is consulted, so any thread may call it */
+bool UnitConverter::maybe_prefixed(const string &units) {
+    unit_id base;
+    for (const SIPrefix &prefix : si_prefixes) {
+        if (starts_with_prefix(units, prefix) &&
+            UnitSymbols::find(units.substr(strlen(prefix.symbol)), base)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** interns expressions and prefixed units, but not plain names that were
+ *  never seen */
+bool UnitConverter::find_units(const string &units, unit_id &id) const {
+    if (UnitSymbols::find(units, id)) {
+        return true;
+    }
+    Compound parsed;
+    if (((units.find_first_of("*/^") == string::npos) &&
+         !maybe_prefixed(units)) ||
+        !parse_compound(units, parsed)) {
+        return false;
+    }
+    id = UnitSymbols::intern(units);
+    compounds.emplace(id, move(parsed));
+    return true;
+}
+
+/** ids of every unit with a slot marked known */
+vector<unit_id> UnitConverter::known_units() const {
+    vector<unit_id> result;
+    for (node_id id = 0; id < nodes.size(); id++) {
+        if (nodes[id].known) {
+            result.push_back(id);
+        }
+    }
+    return result;
+}
+
+/** rules are stored in both directions, so one lookup covers both */
+bool UnitConverter::has_rule(unit_id from_units, unit_id to_units) const {
+    return known(from_units) && (nodes[from_units].edges.count(to_units) != 0);
+}
+
+/** the edges, sorted so the order doesn't depend on the hash map */
+vector<pair<unit_id, Affine>> UnitConverter::rules_of(unit_id units) const {
+    vector<pair<unit_id, Affine>> rules;
+    if (known(units)) {
+        rules.assign(nodes[units].edges.begin(), nodes[units].edges.end());
+        sort(rules.begin(), rules.end(),
+             [](const pair<unit_id, Affine> &a, const pair<unit_id, Affine> &b) {
+                 return a.first < b.first;
+             });
+    }
+    return rules;
+}
+
+/** every rule is stored as an edge in each direction */
+size_t UnitConverter::rule_count() const {
+    size_t edges = 0;
+    for (const Node &node : nodes) {
+        edges += node.edges.size();
+    }
+    return edges / 2;
+}
+
+/** reads a unit's union-find entry */
+bool UnitConverter::root_of(unit_id units, unit_id &root, Affine &to_root) const
+{
+    if (!known(units)) {
+        return false;
+    }
+    root    = nodes[units].root;
+    to_root = nodes[units].to_root;
+    return true;
+}
+
+/** the cache-free path of lookup */
+bool UnitConverter::find_conversion
+(   unit_id from_units, unit_id to_units, Affine &conversion   ) const
+{
+    return resolve(from_units, to_units, conversion, false);
+}
+
+/** interned names resolve as usual; any other name can only be an
+ *  expression, which converts by the ratio of the scales */
+bool UnitConverter::find_conversion
+(   const string &from_units, const string &to_units, Affine &conversion
+)   const
+{
+    node_id from, to;
+    if (UnitSymbols::find(from_units, from) &&
+        UnitSymbols::find(to_units, to)) {
+        return resolve(from, to, conversion, false);
+    }
+
+    Compound a, b;
+    if (!compound_of(from_units, a) || !compound_of(to_units, b) ||
+        (a.dims != b.dims)) {
+        return false;
+    }
+    conversion = Affine{a.scale / b.scale, 0};
+    return true;
+}
+
+/** breadth-first search for the fewest-step chain of rules */
+bool UnitConverter::search
+(   node_id from, node_id to, const set<string> &excluded, Affine &conversion
+)   const
+{
+    // start a new generation, wiping the stamps only when the counter wraps
+    if (++generation == 0) {
+        fill(stamp.begin(), stamp.end(), 0);
+        generation = 1;
+    }
+
+    // excluded units count as already visited
+    for (const string &units : excluded) {
+        node_id id;
+        if (find_unit(units, id)) {
+            stamp[id] = generation;
+        }
+    }
+    if (stamp[from] == generation) {
+        return false;
+    }
+
+    frontier.clear();
+    frontier.push_back(from);
+    stamp[from]  = generation;
+    parent[from] = from;
+    reach[from]  = Affine{1, 0};
+
+    for (size_t next = 0; next < frontier.size(); next++) {
+        node_id u = frontier[next];
+        if (u == to) {
+            conversion = reach[u];
+            return true;
+        }
+        for (const auto &edge : nodes[u].edges) {
+            node_id v = edge.first;
+            if (stamp[v] != generation) {
+                stamp[v]  = generation;
+                parent[v] = u;
+                reach[v]  = edge.second.after(reach[u]);
+                frontier.push_back(v);
+            }
+        }
+    }
+    return false;
 }
 
 /** convert from current UValue units to new to_units */
 UValue UnitConverter::convert_to
-(   const UValue input, const string to_units, set<string> seen   )
+(   const UValue input, const string to_units, const set<string> &seen   )
 {
     string from_units = input.get_units();
-    double from_val   = input.get_value();
+    node_id from, to;
+    double from_factor, to_factor;
+    Affine conversion;
+
+    // don't search a graph that can't contain a path. prefixed units are
+    // searched from and to their base units
+    if (!can_convert(from_units, to_units) ||
+        !find_scaled(from_units, from_factor, from) ||
+        !find_scaled(to_units, to_factor, to) ||
+        !search(from, to, seen, conversion)) {
+        string e_message = "Don't know how to convert from " + from_units \
+                            + " to " + to_units;
+        throw invalid_argument(e_message);
+    }
+    conversion = Affine{1 / to_factor, 0}.after(
+        conversion.after(Affine{from_factor, 0}));
+    return UValue{conversion.apply(input.get_value()), to_units};
+}
+
+/** fewest-step chain of units between two units */
+vector<string> UnitConverter::conversion_path
+(   const string &from_units, const string &to_units   ) const
+{
+    vector<string> path;
+    node_id from, to;
+    double from_factor, to_factor;
+    Affine conversion;
 
-    // add units to seen
-    seen.insert(from_units);
+    if (!can_convert(from_units, to_units) ||
+        !find_scaled(from_units, from_factor, from) ||
+        !find_scaled(to_units, to_factor, to) ||
+        !search(from, to, set<string>{}, conversion)) {
+        return path;
+    }
 
-    for (Conversion c : items) {
-        // If conversion is found, convert and return
-        if ((c.from_units == from_units) && (c.to_units == to_units)) {
-            return UValue{(from_val * c.multiplier), to_units};
+    // walk the parents back to the source, then put them in order, with a
+    // step to or from each prefixed end
+    if (UnitSymbols::name(to) != to_units) {
+        path.push_back(to_units);
+    }
+    for (node_id u = to; u != from; u = parent[u]) {
+        path.push_back(UnitSymbols::name(u));
+    }
+    path.push_back(UnitSymbols::name(from));
+    if (UnitSymbols::name(from) != from_units) {
+        path.push_back(from_units);
+    }
+    reverse(path.begin(), path.end());
+    return path;
+}
+
+/** every member of the component resolves in constant time */
+vector<UValue> UnitConverter::convert_to_all(const UValue &input) const {
+    vector<UValue> result;
+    node_id from = input.get_unit_id();
+    double value = input.get_value();
+
+    // a prefixed unit starts from its base unit, scaled
+    double factor;
+    if (!known(from)) {
+        if (!find_prefixed(input.get_units(), factor, from)) {
+            return result;
         }
-        else if ((c.from_units == from_units) && (seen.count(c.to_units) == 0)){
-            UValue v{(from_val * c.multiplier), c.to_units};
-            try {
-                return convert_to(v, to_units, seen);
-            }
-            catch (invalid_argument e) {
-            }
+        value *= factor;
+    }
+
+    const vector<node_id> &members = nodes[nodes[from].root].members;
+    result.reserve(members.size());
+    for (node_id to : members) {
+        Affine conversion;
+        resolve(from, to, conversion);
+        result.emplace_back(conversion.apply(value), to);
+    }
+    return result;
+}
+
+/** unknown and unconnected targets are left out */
+vector<UValue> UnitConverter::convert_to_all
+(   const UValue &input, const vector<string> &targets   ) const
+{
+    vector<UValue> result;
+    for (const string &units : targets) {
+        node_id to;
+        Affine conversion;
+        if (find_units(units, to) &&
+            resolve(input.get_unit_id(), to, conversion)) {
+            result.emplace_back(conversion.apply(input.get_value()), to);
+        }
+    }
+    return result;
+}
+
+/** conversion from a direct rule, or through the shared root */
+bool UnitConverter::resolve
+(   node_id from, node_id to, Affine &conversion, bool remember   ) const
+{
+    // expressions convert by the ratio of their scales when their
+    // dimension vectors match
+    if (!known(from) || !known(to)) {
+        Compound a, b;
+        if (!compound_of(from, a, remember) ||
+            !compound_of(to, b, remember) || (a.dims != b.dims)) {
+            return false;
+        }
+        conversion = Affine{a.scale / b.scale, 0};
+        return true;
+    }
+
+    // a rule given for exactly this pair is used as written
+    auto direct = nodes[from].edges.find(to);
+    if (direct != nodes[from].edges.end()) {
+        conversion = direct->second;
+        return true;
+    }
+
+    // otherwise both units must share a root, and the conversion goes up to
+    // the root and back down, no matter how long the path between them is
+    if (nodes[from].root != nodes[to].root) {
+        return false;
+    }
+
+    // units joined only by exact rules compose exactly and round once
+    if (nodes[from].exact_base == nodes[to].exact_base) {
+        try {
+            ExactAffine e = nodes[to].exact_root.inverse().after(
+                nodes[from].exact_root);
+            conversion = e.rounded();
+            return true;
+        }
+        catch (overflow_error &e) {
+            // too big to compose exactly, the doubles will do
+        }
+    }
+    const Affine &f = nodes[from].to_root;
+    const Affine &t = nodes[to].to_root;
+    conversion = Affine{f.scale / t.scale, (f.offset - t.offset) / t.scale};
+    return true;
+}
+
+/** inserts a pair at the front of the lru list */
+void UnitConverter::remember(const UnitPair &key, Cached result) {
+    if (cache_capacity == 0) {
+        return;
+    }
+    if (cache.size() >= cache_capacity) {
+        forget(lru.back().first);
+        stats.evictions++;
+    }
+    lru.emplace_front(key, result);
+    cache[key] = lru.begin();
+    if (!result.convertible) {
+        unreachable++;
+    }
+}
+
+/** removes a pair from the cache */
+void UnitConverter::forget(const UnitPair &key) {
+    auto entry = cache.find(key);
+    if (entry != cache.end()) {
+        if (!entry->second->second.convertible) {
+            unreachable--;
+        }
+        lru.erase(entry->second);
+        cache.erase(entry);
+    }
+}
+
+/** walks the cache once, dropping the negative entries */
+void UnitConverter::forget_unreachable() {
+    for (auto it = lru.begin(); it != lru.end(); ) {
+        if (it->second.convertible) {
+            ++it;
+        }
+        else {
+            cache.erase(it->first);
+            it = lru.erase(it);
+        }
+    }
+    unreachable = 0;
+}
+
+/** walks the cache once, dropping the unit's entries and those of every
+ *  id that isn't a unit, which were parsed */
+void UnitConverter::forget_unit(node_id id) {
+    for (auto it = lru.begin(); it != lru.end(); ) {
+        node_id a = it->first.first, b = it->first.second;
+        if ((a != id) && (b != id) && known(a) && known(b)) {
+            ++it;
+            continue;
         }
+        if (!it->second.convertible) {
+            unreachable--;
+        }
+        cache.erase(it->first);
+        it = lru.erase(it);
+    }
+}
+
+/** cache-aware lookup shared by the throwing and non-throwing entry points */
+bool UnitConverter::lookup(node_id from, node_id to, Affine &conversion) {
+    UnitPair key{from, to};
+
+    Cached result;
+    auto entry = cache.find(key);
+    if (entry != cache.end()) {
+        stats.hits++;
+        // move the pair to the front of the lru list
+        lru.splice(lru.begin(), lru, entry->second);
+        result = entry->second->second;
+    }
+    else {
+        stats.misses++;
+        result.convertible = resolve(from, to, result.conversion);
+        remember(key, result);
+    }
+
+    conversion = result.conversion;
+    return result.convertible;
+}
+
+/** two argument function, answered from the cache when possible */
+UValue UnitConverter::convert_to(const UValue input, const string &to_units) {
+    // a name that was never interned can't appear in any rule
+    unit_id to;
+    if (!find_units(to_units, to)) {
+        string e_message = "Don't know how to convert from " \
+                            + input.get_units() + " to " + to_units;
+        throw invalid_argument(e_message);
+    }
+    return convert_to(input, to);
+}
+
+/** conversion between interned units, which never touches a string */
+UValue UnitConverter::convert_to(const UValue input, unit_id to_units) {
+    Affine conversion;
+    if (!lookup(input.get_unit_id(), to_units, conversion)) {
+        string e_message = "Don't know how to convert from " \
+                            + input.get_units() + " to " \
+                            + UnitSymbols::name(to_units);
+        throw invalid_argument(e_message);
+    }
+    return UValue{conversion.apply(input.get_value()), to_units};
+}
+
+/** same as convert_to, but reports failure through an empty optional */
+optional<UValue> UnitConverter::try_convert
+(   const UValue &input, const string &to_units   )
+{
+    unit_id to;
+    if (!find_units(to_units, to)) {
+        return nullopt;
+    }
+    return try_convert(input, to);
+}
+
+/** non-throwing conversion between interned units */
+optional<UValue> UnitConverter::try_convert
+(   const UValue &input, unit_id to_units   )
+{
+    Affine conversion;
+    if (!lookup(input.get_unit_id(), to_units, conversion)) {
+        return nullopt;
+    }
+    return UValue{conversion.apply(input.get_value()), to_units};
+}
+
+/** names are looked up once here, never when the plan is applied */
+ConversionPlan UnitConverter::plan
+(   const string &from_units, const string &to_units   ) const
+{
+    unit_id from, to;
+    if (!find_units(from_units, from) || !find_units(to_units, to)) {
+        string e_message = "Don't know how to convert from " + from_units \
+                            + " to " + to_units;
+        throw invalid_argument(e_message);
+    }
+    return plan(from, to);
+}
+
+/** the plan is stamped with the rules it was resolved from */
+ConversionPlan UnitConverter::plan(unit_id from_units, unit_id to_units) const
+{
+    Affine conversion;
+    if (!resolve(from_units, to_units, conversion)) {
+        string e_message = "Don't know how to convert from " \
+                            + UnitSymbols::name(from_units) + " to " \
+                            + UnitSymbols::name(to_units);
+        throw invalid_argument(e_message);
+    }
+    return ConversionPlan{from_units, to_units, conversion, rules_version};
+}
+
+uint64_t UnitConverter::version() const {
+    return rules_version;
+}
+
+/** the versions are unique, so equal means same rules */
+bool UnitConverter::is_current(const ConversionPlan &plan) const {
+    return plan.version() == rules_version;
+}
+
+/** resolves the pair once, then scales the whole array */
+void UnitConverter::convert_batch
+(   const double *in, double *out, size_t count, const string &from_units,
+    const string &to_units
+)
+{
+    unit_id from, to;
+    Affine conversion;
+    if (!find_units(from_units, from) || !find_units(to_units, to) ||
+        !lookup(from, to, conversion)) {
+        string e_message = "Don't know how to convert from " + from_units \
+                            + " to " + to_units;
+        throw invalid_argument(e_message);
+    }
+    scale(in, out, count, conversion.scale, conversion.offset);
+}
+
+/** in-place batch conversion of a vector */
+void UnitConverter::convert_batch
+(   vector<double> &values, const string &from_units, const string &to_units   )
+{
+    convert_batch(values.data(), values.data(), values.size(), from_units,
+                  to_units);
+}
+
+/** returns the cache counters */
+CacheStats UnitConverter::cache_stats() const {
+    return stats;
+}
+
+/** drops every cached pair and zeroes the counters */
+void UnitConverter::clear_cache() {
+    lru.clear();
+    cache.clear();
+    unreachable = 0;
+    stats = CacheStats{0, 0, 0};
+}
+
+thread_local BoundConverter *BoundConverter::innermost = nullptr;
+
+/** pushes this binding onto the thread's stack of bindings */
+BoundConverter::BoundConverter(const UnitConverter &converter)
+    : converter(converter), previous(innermost) {
+    innermost = this;
+}
+
+BoundConverter::~BoundConverter() {
+    innermost = previous;
+}
+
+/** one slot per hash, so a pair that collides just resolves again */
+const ConversionPlan &BoundConverter::plan(unit_id from_units, unit_id to_units)
+{
+    uint64_t key  = (uint64_t(from_units) << 32) | to_units;
+    size_t   slot = (key * 0x9e3779b97f4a7c15ULL) >> 58;
+    optional<ConversionPlan> &p = plans[slot];
+    if (!p || (p->from_units() != from_units) || (p->to_units() != to_units) ||
+        !converter.is_current(*p)) {
+        p = converter.plan(from_units, to_units);
+    }
+    return *p;
+}
+
+/** same units need no converter at all */
+UValue BoundConverter::convert(const UValue &input, unit_id to_units) {
+    if (input.get_unit_id() == to_units) {
+        return input;
     }
+    if (innermost == nullptr) {
+        string e_message = "No converter bound to convert from " \
+                           + input.get_units() + " to " \
+                           + UnitSymbols::name(to_units);
+        throw invalid_argument(e_message);
+    }
+    return innermost->plan(input.get_unit_id(), to_units)(input);
+}
+
+/** the left-hand side is taken by value, so a temporary is reused */
+UValue operator+(UValue a, const UValue &b) {
+    return a += b;
+}
+
+UValue operator-(UValue a, const UValue &b) {
+    return a -= b;
+}
+
+UValue operator*(UValue a, double k) {
+    return a *= k;
+}
+
+UValue operator*(double k, UValue a) {
+    return a *= k;
+}
+
+UValue operator/(UValue a, double k) {
+    return a /= k;
+}
+
+bool operator==(const UValue &a, const UValue &b) {
+    return a.get_value() ==
+           BoundConverter::convert(b, a.get_unit_id()).get_value();
+}
+
+bool operator!=(const UValue &a, const UValue &b) {
+    return !(a == b);
+}
+
+bool operator<(const UValue &a, const UValue &b) {
+    return a.get_value() <
+           BoundConverter::convert(b, a.get_unit_id()).get_value();
+}
+
+bool operator>(const UValue &a, const UValue &b) {
+    return a.get_value() >
+           BoundConverter::convert(b, a.get_unit_id()).get_value();
+}
 
-    string e_message = "Don't know how to convert from " + from_units + " to " \
-                        + to_units;
-    throw invalid_argument(e_message);
+bool operator<=(const UValue &a, const UValue &b) {
+    return a.get_value() <=
+           BoundConverter::convert(b, a.get_unit_id()).get_value();
 }
 
-/** two argument function, which calls the three argument one */
-UValue UnitConverter::convert_to(const UValue input, const string to_units) {
-    return convert_to(input, to_units, set<string>{});
+bool operator>=(const UValue &a, const UValue &b) {
+    return a.get_value() >=
+           BoundConverter::convert(b, a.get_unit_id()).get_value();
 }
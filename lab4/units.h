@@ -1,19 +1,32 @@
+#ifndef UNITS_HH
+#define UNITS_HH
+
+#include "symbols.h"
+#include "rational.h"
 #include <string>
-#include <vector>
 #include <set>
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 using namespace std;
 
 /** a unit-value class */
 class UValue {
     /** represents the numerical value of the data */
     double value;
-    /** represents the units the data is in */
-    string units;
+    /** represents the units the data is in, as an interned id */
+    unit_id units;
 
 public:
     /** constructor */
     UValue(double value, const string units);
 
+    /** constructor for units that are already interned */
+    UValue(double value, unit_id units);
+
     /** accessors */
     /**
      * gets the value of the UValue instance
@@ -27,43 +40,625 @@ public:
      * @param instance of UValue
      * @return the string representing the units
      */
-    string get_units() const;
+    const string &get_units() const;
+
+    /**
+     * gets the interned id of the units of the UValue instance
+     * @param instance of UValue
+     * @return the id of the units
+     */
+    unit_id get_unit_id() const;
+
+    /** arithmetic. the right-hand side is converted to this value's units
+     *  through the innermost BoundConverter, so it throws invalid_argument
+     *  if the units differ and none is bound or it can't convert them */
+    UValue &operator+=(const UValue &other);
+    UValue &operator-=(const UValue &other);
+
+    /** scaling by plain numbers */
+    UValue &operator*=(double k);
+    UValue &operator/=(double k);
+
+    /** negation */
+    UValue operator-() const;
+};
+
+static_assert(sizeof(UValue) == 16, "UValue should be a double and an id");
+
+/**
+ * a conversion that may include an offset, such as celsius to fahrenheit.
+ * converts a value x to scale * x + offset. plain ratios have offset 0.
+ */
+struct Affine {
+    /** the multiplier */
+    double scale;
+    /** added after multiplying */
+    double offset;
+
+    /** applies the conversion to a value */
+    double apply(double x) const {
+        return scale * x + offset;
+    }
+
+    /** the conversion that applies 'first', then this one */
+    Affine after(const Affine &first) const {
+        return Affine{scale * first.scale, scale * first.offset + offset};
+    }
+
+    /** the conversion that undoes this one */
+    Affine inverse() const {
+        return Affine{1 / scale, -offset / scale};
+    }
+};
+
+/**
+ * an Affine with exact rational parts, for rules given as exact decimals.
+ * composing and inverting throw overflow_error if a part no longer fits
+ * in 64 bits
+ */
+struct ExactAffine {
+    /** the multiplier */
+    Rational scale;
+    /** added after multiplying */
+    Rational offset;
+
+    /** rounds both parts to the nearest double */
+    Affine rounded() const {
+        return Affine{scale.to_double(), offset.to_double()};
+    }
+
+    /** the conversion that applies 'first', then this one */
+    ExactAffine after(const ExactAffine &first) const {
+        return ExactAffine{scale * first.scale, scale * first.offset + offset};
+    }
+
+    /** the conversion that undoes this one */
+    ExactAffine inverse() const {
+        Rational r = scale.reciprocal();
+        return ExactAffine{r, -offset * r};
+    }
+};
+
+/**
+ * a conversion between two units resolved ahead of time by
+ * UnitConverter::plan. applying it does no lookups and allocates nothing.
+ * it records the version of the rules it was resolved from, so a converter
+ * can tell when later rules or a reload have made it stale.
+ */
+class ConversionPlan {
+    /** units converted from */
+    unit_id from;
+    /** units converted to */
+    unit_id to;
+    /** the composed conversion */
+    Affine conversion;
+    /** version of the rules the plan was resolved from */
+    uint64_t rules_version;
+
+public:
+    /** constructor - normally called by UnitConverter::plan */
+    ConversionPlan(unit_id from, unit_id to, const Affine &conversion,
+                   uint64_t rules_version);
+
+    /** accessors */
+    /**
+     * gets the units the plan converts from
+     * @param void
+     * @return the interned units
+     */
+    unit_id from_units() const;
+
+    /**
+     * gets the units the plan converts to
+     * @param void
+     * @return the interned units
+     */
+    unit_id to_units() const;
+
+    /**
+     * gets the composed conversion
+     * @param void
+     * @return the multiplier and offset
+     */
+    const Affine &get_conversion() const;
+
+    /**
+     * gets the version of the rules the plan was resolved from
+     * @param void
+     * @return the rules version
+     */
+    uint64_t version() const;
+
+    /** converts a plain value */
+    double operator()(double value) const {
+        return conversion.apply(value);
+    }
+
+    /**
+     * converts a UValue, which must be in the plan's from units
+     * throws invalid_argument if it is in other units
+     * @param UValue instance
+     * @return the converted UValue
+     */
+    UValue operator()(const UValue &input) const;
+
+    /**
+     * converts a whole array with the vectorized kernel. 'in' and 'out' may
+     * be the same array
+     * @param the input values, where to write the results, and the number
+     *         of values
+     * @return void
+     */
+    void operator()(const double *in, double *out, size_t count) const;
+
+    /**
+     * converts a vector of values in place
+     * @param the values
+     * @return void
+     */
+    void operator()(vector<double> &values) const;
+};
+
+/** counters describing how well the conversion cache is doing */
+struct CacheStats {
+    /** lookups answered from the cache */
+    size_t hits;
+    /** lookups that had to be resolved from the rules */
+    size_t misses;
+    /** entries dropped to stay within the capacity */
+    size_t evictions;
+};
+
+/** memory held by a conversion graph's tables, in bytes */
+struct GraphMemory {
+    /** slots in the per-unit tables, including ids that are in no rule */
+    size_t unit_slots;
+    /** stored edges, two per rule */
+    size_t edges;
+    /** the edges themselves */
+    size_t edge_bytes;
+    /** per-unit tables: roots, conversions to them, and members */
+    size_t unit_bytes;
+    /** caches and search scratch */
+    size_t other_bytes;
+
+    /** everything together */
+    size_t total() const {
+        return edge_bytes + unit_bytes + other_bytes;
+    }
 };
 
+class FrozenGraph;
+
 /**
  * class contains all possible conversions between a pair of units as
  * given by conversion rules
  */
 class UnitConverter {
-    struct Conversion {
-        /** unit to be converted from */
-        string from_units;
-        /** ratio between unit conversion */
-        double multiplier;
-        /** unit to be convert to */
-        string to_units;
+    /** units are indexed by their interned id */
+    using node_id = unit_id;
+
+    /** a unit and everything the converter knows about it */
+    struct Node {
+        /** whether the unit appears in any rule */
+        bool known;
+        /** outgoing edges, keyed by the unit converted to. the mapped value
+         *  converts a value in this unit to that unit */
+        unordered_map<node_id, Affine> edges;
+        /** representative unit of the component */
+        node_id root;
+        /** converts a value in this unit to the root unit */
+        Affine to_root;
+        /** all units of the component, only kept on its root */
+        vector<node_id> members;
+        /** the unit this one reaches through exact rules alone, chosen
+         *  like the root. units with the same exact base compose exactly */
+        node_id exact_base;
+        /** exact conversion from this unit to its exact base */
+        ExactAffine exact_root;
+        /** all units with this exact base, only kept on the base, and
+         *  empty while the base stands alone */
+        vector<node_id> exact_members;
+    };
+    /** every unit, indexed by unit_id. ids past the end, or with known
+     *  unset, appear in no rule */
+    vector<Node> nodes;
+
+    /** scratch space of the breadth-first search, reused across calls. a
+     *  unit counts as visited when its stamp equals the current generation,
+     *  so nothing needs clearing between searches */
+    mutable vector<unsigned> stamp;
+    /** unit each visited unit was reached from */
+    mutable vector<node_id> parent;
+    /** conversion from the search source to each visited unit */
+    mutable vector<Affine> reach;
+    /** the search frontier */
+    mutable vector<node_id> frontier;
+    /** generation of the current search */
+    mutable unsigned generation;
+
+    /**
+     * finds the id of a unit
+     * @param the unit name, and where to store its id
+     * @return true if the unit appears in some rule
+     */
+    bool find_unit(const string &units, node_id &id) const;
+
+    /**
+     * checks whether an id appears in some rule
+     * @param the unit's id
+     * @return true if the unit is known to this converter
+     */
+    bool known(node_id id) const;
+
+    /**
+     * grows the per-unit tables so every id below size has a slot
+     * @param the number of slots needed
+     * @return void
+     */
+    void reserve_units(size_t size);
+
+    /**
+     * gets the id of a unit, registering it as its own single-unit
+     * component if it is new
+     * @param the unit name
+     * @return the unit's id
+     */
+    node_id add_unit(const string &units);
+
+    /**
+     * merges the components of two units joined by a conversion. the smaller
+     * component is relabeled onto the root of the larger one, so every unit
+     * always points straight at its root. an exact conversion also merges
+     * the units' exact bases the same way.
+     * @param the units, the new conversion between them, and the same
+     *         conversion exactly, or nullptr if it isn't exact
+     * @return void
+     */
+    void join(node_id from, const Affine &conversion, node_id to,
+              const ExactAffine *exact);
+
+    /**
+     * merges the exact bases of two units joined by an exact conversion,
+     * relabeling the smaller group onto the larger one's base
+     * @param the units, the exact conversion between them, and whether
+     *         their components were merged just now rather than already
+     *         connected
+     * @return void
+     */
+    void join_exact(node_id from, const ExactAffine &exact, node_id to,
+                    bool merged);
+
+    /**
+     * adds a rule in both directions and merges the components
+     * throws invalid_argument if the rule already exists
+     * @param the units, the conversion each way, and the exact conversion
+     *         or nullptr
+     * @return void
+     */
+    void add_rule(const string &from_units, const Affine &conversion,
+                  const Affine &inverse, const string &to_units,
+                  const ExactAffine *exact);
+
+    /** a compound unit expression such as kg*m^2/s^2, reduced to a
+     *  dimension vector and a scale. each dimension is the root of a
+     *  component, so units convert iff their vectors match */
+    struct Compound {
+        /** whether the expression parsed and all its units are known */
+        bool valid;
+        /** (root, exponent) pairs sorted by root, with no zero exponents */
+        vector<pair<node_id, int>> dims;
+        /** how many of the product of the roots make up one of this unit.
+         *  units with an offset can't be part of an expression */
+        double scale;
+    };
+    /** parsed expressions, keyed by the interned id of the whole text.
+     *  emptied whenever components change, since that moves roots */
+    mutable unordered_map<node_id, Compound> compounds;
+
+    /**
+     * gets the dimension vector of a unit, parsing and caching it if it is
+     * an expression rather than a unit named in the rules
+     * @param the unit's id, where to store the result, and whether a parsed
+     *         expression may be added to the cache
+     * @return true if the unit is known or a valid expression
+     */
+    bool compound_of(node_id id, Compound &result, bool remember = true) const;
+
+    /**
+     * gets the dimension vector of a unit name without interning it or
+     * caching anything. plain names that were never interned are only
+     * parsed if they may be prefixed units
+     * @param the unit name, and where to store the result
+     * @return true if the unit is known or a valid expression
+     */
+    bool compound_of(const string &units, Compound &result) const;
+
+    /**
+     * parses a unit expression: units or numbers joined by '*' and '/',
+     * each optionally raised to an integer power with '^'. every operator
+     * applies to the factor right after it, so a/b*c is a*c/b. a unit not
+     * named in the rules may be a named unit with an SI prefix, such as km.
+     * @param the expression, and where to store the result
+     * @return true if the expression is valid and all its units are known
+     */
+    bool parse_compound(const string &expr, Compound &result) const;
+
+    /**
+     * splits a name into an SI prefix and a unit named in the rules, such
+     * as k and m for km. units with an offset take no prefix
+     * @param the unit name, and where to store the prefix's factor and the
+     *         id of the unit after it
+     * @return true if the name splits that way
+     */
+    bool find_prefixed(const string &units, double &factor,
+                       node_id &base) const;
+
+    /**
+     * finds a unit named in the rules, or splits a prefixed one as
+     * find_prefixed does
+     * @param the unit name, and where to store the factor from it to the
+     *         unit in the rules and that unit's id
+     * @return true if the name is a unit in the rules or a prefixed one
+     */
+    bool find_scaled(const string &units, double &factor,
+                     node_id &id) const;
+
+    /** a (from, to) pair of unit ids used as a cache key */
+    using UnitPair = pair<node_id, node_id>;
+    /** hashes both indices of a pair as one 64-bit word */
+    struct UnitPairHash {
+        size_t operator()(const UnitPair &p) const {
+            return hash<uint64_t>{}((uint64_t(p.first) << 32) | p.second);
+        }
+    };
+    /** a cached lookup result. pairs known to be unreachable are cached
+     *  too, so a disconnected pair fails without touching the rules again */
+    struct Cached {
+        /** whether the pair can be converted at all */
+        bool convertible;
+        /** composed conversion, meaningless if not convertible */
+        Affine conversion;
     };
-    /** list of all pairs of conversions */
-    vector<Conversion> items;
+    /** cached lookups, most recently used first */
+    list<pair<UnitPair, Cached>> lru;
+    /** index into the lru list for each cached pair */
+    unordered_map<UnitPair, list<pair<UnitPair, Cached>>::iterator,
+                  UnitPairHash> cache;
+    /** number of cached pairs that are known to be unreachable */
+    size_t unreachable;
+    /** most entries the cache may hold */
+    size_t cache_capacity;
+    /** hit/miss/eviction counters */
+    CacheStats stats;
+
+    /** version of the rules. every change draws a new number from one
+     *  process-wide counter, so no two sets of rules ever share one */
+    uint64_t rules_version;
+
+    /**
+     * resolves the conversion between two units from the rules
+     * @param the two units, where to store the conversion, and whether
+     *         parsed expressions may be added to the cache
+     * @return true if the units are convertible
+     */
+    bool resolve(node_id from, node_id to, Affine &conversion,
+                 bool remember = true) const;
+
+    /**
+     * resolves the conversion between two units through the cache
+     * @param the two units, and where to store the conversion
+     * @return true if the units are convertible
+     */
+    bool lookup(node_id from, node_id to, Affine &conversion);
+
+    /**
+     * breadth-first search for the shortest chain of rules between two
+     * units. on success, parent[] holds the chain back to 'from'.
+     * @param the two units, units that may not be used, and where to store
+     *         the composed conversion
+     * @return true if a chain was found
+     */
+    bool search(node_id from, node_id to, const set<string> &excluded,
+                Affine &conversion) const;
+
+    /**
+     * stores a lookup result, evicting the least recently used entry if the
+     * cache is full
+     * @param the pair of units and the result of resolving them
+     * @return void
+     */
+    void remember(const UnitPair &key, Cached result);
+
+    /**
+     * drops the cached entry for a pair, if any
+     * @param the pair of units
+     * @return void
+     */
+    void forget(const UnitPair &key);
+
+    /**
+     * drops every pair cached as unreachable. called whenever two
+     * components merge, since that may connect them.
+     * @param void
+     * @return void
+     */
+    void forget_unreachable();
+
+    /**
+     * drops every cached pair involving a unit, or an expression or
+     * prefixed unit. called when a name that may have been resolved as an
+     * expression or prefixed unit becomes a unit of its own, since its
+     * cached conversions, and those of expressions parsed through it, may
+     * no longer hold
+     * @param the unit
+     * @return void
+     */
+    void forget_unit(node_id id);
 
 public:
+    /**
+     * constructor
+     * @param most (from, to) pairs to keep in the conversion cache
+     */
+    UnitConverter(size_t cache_capacity = 1024);
+
+    /**
+     * copy constructor. copies the rules and components; the copy starts
+     * with an empty cache and zeroed counters, since cache entries point
+     * into the original's lru list
+     * @param the converter to copy
+     */
+    UnitConverter(const UnitConverter &other);
+
+    /**
+     * copy assignment, with the same cache handling as the copy constructor
+     * @param the converter to copy
+     * @return this converter
+     */
+    UnitConverter &operator=(const UnitConverter &other);
+
+    /** moving keeps the cache, since list iterators survive a move */
+    UnitConverter(UnitConverter &&other) = default;
+    UnitConverter &operator=(UnitConverter &&other) = default;
+
     /** methods */
     /**
-     * add a pair of conversions to the vector list
+     * add a pair of conversions to the adjacency map
      * @param two strings representing the units to be converted to and from,
-     *         and a double representing the conversion ratio.
+     *         a double representing the conversion ratio, and an optional
+     *         offset added after multiplying (1 C = 1.8 F + 32)
      * @return void
      */
-    void add_conversion(string from_units, double multiplier, string to_units);
+    void add_conversion(const string &from_units, double multiplier,
+                        const string &to_units, double offset = 0);
 
     /**
-     * convert funtion to convert to 'to_units'
+     * adds a rule given exactly. conversions between units joined only by
+     * exact rules are composed exactly and rounded to double once, so long
+     * paths don't drift and every path between two units gives the same
+     * factor. a chain whose fractions outgrow 64 bits quietly falls back
+     * to doubles.
+     * throws invalid_argument if the conversion already exists or the
+     * multiplier is zero
+     * @param the units to convert from and to, the exact multiplier, and an
+     *         optional exact offset
+     * @return void
+     */
+    void add_conversion(const string &from_units, const Rational &multiplier,
+                        const string &to_units,
+                        const Rational &offset = Rational());
+
+    /**
+     * checks whether two units are connected by the rules, in constant time.
+     * units may also be expressions such as km/h or kg*m^2/s^2, which are
+     * convertible when their dimension vectors match
+     * @param the units to convert from and to
+     * @return true if convert_to would succeed for this pair
+     */
+    bool can_convert(const string &from_units, const string &to_units) const;
+
+    /**
+     * finds the id of a unit name. names that are unit expressions, or
+     * units with an SI prefix, are interned, so they can be cached like any
+     * other unit. a name in the rules is always taken as written, so a
+     * rule for 'min' keeps it from being read as milli-inches
+     * @param the unit name, and where to store its id
+     * @return false if the name was never interned and isn't an expression
+     *         or a prefixed unit
+     */
+    bool find_units(const string &units, unit_id &id) const;
+
+    /**
+     * checks whether a name starts with an SI prefix followed by an
+     * interned name, so it may be a prefixed unit. prefixed names aren't
+     * interned until they are looked up, and the rules aren't consulted
+     * here, so a true result is only a hint
+     * @param the unit name
+     * @return true if the name could be a prefixed unit
+     */
+    static bool maybe_prefixed(const string &units);
+
+    /**
+     * lists every unit that appears in some rule
+     * @param void
+     * @return the ids of the known units, in increasing order
+     */
+    vector<unit_id> known_units() const;
+
+    /**
+     * checks whether a rule was given for exactly this pair of units, in
+     * either direction
+     * @param the two units
+     * @return true if add_conversion would reject the pair as a duplicate
+     */
+    bool has_rule(unit_id from_units, unit_id to_units) const;
+
+    /**
+     * lists the rules given for a unit, in the direction away from it
+     * @param the unit
+     * @return each unit it has a rule for and the conversion to it, in
+     *         increasing order of unit id, or nothing if it is unknown
+     */
+    vector<pair<unit_id, Affine>> rules_of(unit_id units) const;
+
+    /**
+     * counts the rules added to this converter
+     * @param void
+     * @return the number of rules, each counted once for both directions
+     */
+    size_t rule_count() const;
+
+    /**
+     * gets the component representative of a unit and the conversion from
+     * the unit to it
+     * @param the unit, and where to store its root and conversion
+     * @return false if the unit appears in no rule
+     */
+    bool root_of(unit_id units, unit_id &root, Affine &to_root) const;
+
+    /**
+     * resolves the conversion between two interned units without touching
+     * any cache, so several threads may call it at once on a converter that
+     * nobody is modifying. expressions are parsed again on every call.
+     * @param the units to convert from and to, and where to store the
+     *         conversion
+     * @return true if the units are convertible
+     */
+    bool find_conversion(unit_id from_units, unit_id to_units,
+                         Affine &conversion) const;
+
+    /**
+     * resolves the conversion between two unit names like the version
+     * taking ids, but never interns a name, so it is safe to call with
+     * names from untrusted input. expressions are parsed on every call.
+     * @param the units to convert from and to, and where to store the
+     *         conversion
+     * @return true if the units are convertible
+     */
+    bool find_conversion(const string &from_units, const string &to_units,
+                         Affine &conversion) const;
+
+    /**
+     * convert funtion to convert to 'to_units' along the chain of rules with
+     * the fewest steps. prefixed units convert through their base unit
      * @param UValue instance, a string of the units to convert that instance
      *         to, and set of stings of units that cannot be used in the
-     *         conversion (starts empty & accumulates in the function)
+     *         conversion
      * @return the new instance of the converted UValue
      */
-    UValue convert_to(const UValue input, const string to_units,set<string> seen);
+    UValue convert_to(const UValue input, const string to_units,
+                      const set<string> &seen);
+
+    /**
+     * finds the chain of rules with the fewest steps between two units. a
+     * prefixed unit takes one step to its base unit, as km to m
+     * @param the units to convert from and to
+     * @return every unit along the chain, starting with from_units and
+     *         ending with to_units, or an empty list if there is none
+     */
+    vector<string> conversion_path(const string &from_units,
+                                   const string &to_units) const;
 
     /**
      * convert funtion to convert to 'to_units'
@@ -71,5 +666,241 @@ public:
      *         to
      * @return the new instance of the converted UValue
      */
-    UValue convert_to(const UValue input, const string to_units);
+    UValue convert_to(const UValue input, const string &to_units);
+
+    /**
+     * converts a value to every unit it can be converted to, in one pass
+     * over the unit's component rather than a search per target
+     * @param UValue instance
+     * @return the value in every unit connected to its units by the rules,
+     *         itself included, or nothing if its units appear in no rule.
+     *         a prefixed unit gives every unit connected to its base unit
+     */
+    vector<UValue> convert_to_all(const UValue &input) const;
+
+    /**
+     * converts a value to each of a list of units, skipping the ones it
+     * can't be converted to
+     * @param UValue instance, and the units to convert it to, which may
+     *         also be unit expressions
+     * @return the value in each convertible target, in the order given
+     */
+    vector<UValue> convert_to_all(const UValue &input,
+                                  const vector<string> &targets) const;
+
+    /**
+     * convert funtion to convert to units that are already interned
+     * @param UValue instance, and the id of the units to convert to
+     * @return the new instance of the converted UValue
+     */
+    UValue convert_to(const UValue input, unit_id to_units);
+
+    /**
+     * non-throwing version of convert_to, for callers in tight loops
+     * @param UValue instance, and a string of the units to convert that
+     *         instance to
+     * @return the converted UValue, or nothing if the units are unknown or
+     *         not connected by the rules
+     */
+    optional<UValue> try_convert(const UValue &input, const string &to_units);
+
+    /**
+     * non-throwing version of convert_to for interned units
+     * @param UValue instance, and the id of the units to convert to
+     * @return the converted UValue, or nothing if the units are unknown or
+     *         not connected by the rules
+     */
+    optional<UValue> try_convert(const UValue &input, unit_id to_units);
+
+    /**
+     * resolves a pair of units once, for converting many values later
+     * throws invalid_argument if the units are not connected by the rules
+     * @param the units to convert from and to
+     * @return the plan
+     */
+    ConversionPlan plan(const string &from_units,
+                        const string &to_units) const;
+
+    /**
+     * resolves a pair of interned units once
+     * throws invalid_argument if the units are not connected by the rules
+     * @param the units to convert from and to
+     * @return the plan
+     */
+    ConversionPlan plan(unit_id from_units, unit_id to_units) const;
+
+    /**
+     * gets the version of the rules, which changes with every rule added.
+     * copies share their original's version until either one changes
+     * @param void
+     * @return the rules version
+     */
+    uint64_t version() const;
+
+    /**
+     * checks whether a plan was resolved from these rules as they are now.
+     * any added rule makes every earlier plan stale, even ones it doesn't
+     * change, and so does a reload
+     * @param the plan
+     * @return true if the plan's version matches
+     */
+    bool is_current(const ConversionPlan &plan) const;
+
+    /**
+     * converts a whole array of values between two units. the conversion is
+     * resolved once and applied with a vectorized kernel. 'in' and 'out'
+     * may be the same array to convert in place.
+     * @param the input values, where to write the results, the number of
+     *         values, and the units to convert from and to
+     * @return void
+     */
+    void convert_batch(const double *in, double *out, size_t count,
+                       const string &from_units, const string &to_units);
+
+    /**
+     * converts a vector of values between two units in place
+     * @param the values, and the units to convert from and to
+     * @return void
+     */
+    void convert_batch(vector<double> &values, const string &from_units,
+                       const string &to_units);
+
+    /**
+     * writes the rules, names and component tables to a versioned binary
+     * snapshot with a checksum, to be loaded later with load_snapshot
+     * throws invalid_argument if the file can't be written
+     * @param the name of the snapshot file
+     * @return void
+     */
+    void save_snapshot(const string &filename) const;
+
+    /**
+     * builds a converter from a snapshot written by save_snapshot. the file
+     * is mapped and its tables are copied in without parsing or re-merging
+     * any components, but every name is interned and every rule inserted,
+     * so loading still takes time in proportion to the rules.
+     * MappedSnapshot reads the file in place instead.
+     * throws invalid_argument if the file is missing, truncated, of another
+     * version, or fails its checksum
+     * @param the name of the snapshot file, and the cache size of the new
+     *         converter
+     * @return the loaded converter
+     */
+    static UnitConverter load_snapshot(const string &filename,
+                                       size_t cache_capacity = 1024);
+
+    /**
+     * checks whether a file starts like a snapshot
+     * @param the name of the file
+     * @return true if the file has the snapshot magic number
+     */
+    static bool is_snapshot(const string &filename);
+
+    /**
+     * copies the rules into a read-only compressed sparse row graph, which
+     * takes a fraction of the memory and answers the same lookups
+     * throws invalid_argument if there are too many edges to number in
+     * 32 bits
+     * @param void
+     * @return the frozen graph
+     */
+    FrozenGraph freeze() const;
+
+    /**
+     * estimates the memory held by the converter's tables, counting each
+     * heap block as the allocator rounds it
+     * @param void
+     * @return bytes used by the edges, the per-unit tables, and the caches
+     *         and search scratch
+     */
+    GraphMemory memory_usage() const;
+
+    /**
+     * gets the conversion cache counters
+     * @param void
+     * @return hit, miss and eviction counts since construction or last reset
+     */
+    CacheStats cache_stats() const;
+
+    /**
+     * empties the conversion cache and resets its counters
+     * @param void
+     * @return void
+     */
+    void clear_cache();
 };
+
+/**
+ * binds a converter for UValue arithmetic on the current thread. while a
+ * binding is alive, mixing units in +, -, and comparisons converts through
+ * it; bindings nest, and the innermost one is used. each binding keeps the
+ * plans it has resolved in a small table, so repeated arithmetic on the
+ * same pair of units costs a table probe, a version check and one
+ * multiply-add. a plan goes stale, and is resolved again, when rules are
+ * added to the converter.
+ * the converter must outlive the binding, and must not be used by another
+ * thread while it is bound, since resolving a plan may fill its caches.
+ */
+class BoundConverter {
+    /** the converter arithmetic goes through */
+    const UnitConverter &converter;
+    /** the binding this one hides, restored when it ends */
+    BoundConverter *previous;
+    /** resolved plans, indexed by a hash of the pair of units */
+    optional<ConversionPlan> plans[64];
+
+    /** the innermost binding of this thread, or nullptr */
+    static thread_local BoundConverter *innermost;
+
+    /**
+     * finds the plan for a pair of units, resolving it if it isn't in the
+     * table or the rules have changed since
+     * throws invalid_argument if the units are not connected by the rules
+     * @param the units to convert from and to
+     * @return the current plan
+     */
+    const ConversionPlan &plan(unit_id from_units, unit_id to_units);
+
+public:
+    /**
+     * constructor - binds the converter until the binding is destroyed
+     * @param the converter
+     */
+    explicit BoundConverter(const UnitConverter &converter);
+
+    /** destructor - restores the binding this one hid */
+    ~BoundConverter();
+
+    BoundConverter(const BoundConverter &) = delete;
+    BoundConverter &operator=(const BoundConverter &) = delete;
+
+    /**
+     * converts a value through the innermost binding. values already in
+     * the target units are returned as they are, bound or not
+     * throws invalid_argument if no converter is bound, or it can't convert
+     * the units
+     * @param UValue instance, and the id of the units to convert to
+     * @return the converted UValue
+     */
+    static UValue convert(const UValue &input, unit_id to_units);
+};
+
+/** sum and difference, in the units of the left-hand side */
+UValue operator+(UValue a, const UValue &b);
+UValue operator-(UValue a, const UValue &b);
+
+/** scaling by plain numbers */
+UValue operator*(UValue a, double k);
+UValue operator*(double k, UValue a);
+UValue operator/(UValue a, double k);
+
+/** comparisons, after converting the right-hand side to the units of the
+ *  left. values compare exactly, as doubles do */
+bool operator==(const UValue &a, const UValue &b);
+bool operator!=(const UValue &a, const UValue &b);
+bool operator<(const UValue &a, const UValue &b);
+bool operator>(const UValue &a, const UValue &b);
+bool operator<=(const UValue &a, const UValue &b);
+bool operator>=(const UValue &a, const UValue &b);
+
+#endif // UNITS_HH